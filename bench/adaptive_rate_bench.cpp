@@ -0,0 +1,149 @@
+/*
+ * Replay bench for source/AdaptiveRate.h.
+ *
+ * Replays a trace sampled finely in time through the controller and through
+ * fixed rates, rebuilds the signal from the samples each one took by linear
+ * interpolation, and reports the samples spent against the error of that
+ * reconstruction over every point of the trace.
+ *
+ *   g++ -std=c++11 -O2 -I../source adaptive_rate_bench.cpp -o adaptive_rate_bench
+ *   ./adaptive_rate_bench [trace] [fastest ms] [period ms] [threshold permille] [steady multiplier]
+ *
+ * A trace is one "time_ms r g b" line per point, evenly spaced. Without
+ * one, or with "-" in its place, an hour of office lighting at 10 ms is
+ * made up: daylight drifting, lamps switched on and off, blinds lowered
+ * and raised, and sensor noise.
+ *
+ * The period is the configured one. The firmware stretches it in steady
+ * light by adaptive-steady-multiplier, 2 by default as in mbed_app.json.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "AdaptiveRate.h"
+
+struct point_t {
+    uint32_t time_ms;
+    uint16_t value[3];
+};
+
+static std::vector<point_t> load(const char *path) {
+    std::vector<point_t> trace;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return trace;
+    }
+    unsigned long time_ms;
+    unsigned r, g, b;
+    while (fscanf(file, "%lu %u %u %u", &time_ms, &r, &g, &b) == 4) {
+        point_t point = { (uint32_t) time_ms, { (uint16_t) r, (uint16_t) g, (uint16_t) b } };
+        trace.push_back(point);
+    }
+    fclose(file);
+    return trace;
+}
+
+static std::vector<point_t> synthesize() {
+    std::vector<point_t> trace;
+    uint32_t seed = 1;
+    for (uint32_t t = 0; t < 3600000; t += 10) {
+        double seconds = t / 1000.0;
+        double daylight = 3000 + 800 * sin(seconds / 900.0);
+        /* lamps on from 10 to 25 minutes and from 40 to 50, switching takes 50 ms */
+        double lamps = 0;
+        if (seconds > 600 && seconds < 1500) lamps = fmin(1.0, (seconds - 600) / 0.05);
+        if (seconds >= 1500 && seconds < 1500.05) lamps = 1.0 - (seconds - 1500) / 0.05;
+        if (seconds > 2400 && seconds < 3000) lamps = fmin(1.0, (seconds - 2400) / 0.05);
+        /* blinds lowered over 20 s at 30 minutes, raised over 20 s at 35 */
+        double blinds = 1.0;
+        if (seconds > 1800 && seconds < 2100) blinds = 1.0 - 0.7 * fmin(1.0, (seconds - 1800) / 20.0);
+        if (seconds >= 2100) blinds = 0.3 + 0.7 * fmin(1.0, (seconds - 2100) / 20.0);
+        const double tint[3] = { 1.0, 1.2, 0.8 };
+        point_t point;
+        point.time_ms = t;
+        for (int c = 0; c < 3; c++) {
+            seed = seed * 1103515245u + 12345u;
+            double noise = ((seed >> 16) % 9) - 4.0;
+            double level = tint[c] * (daylight * blinds + 6000 * lamps) + noise;
+            point.value[c] = (uint16_t) fmax(0.0, fmin(65535.0, level));
+        }
+        trace.push_back(point);
+    }
+    return trace;
+}
+
+struct result_t {
+    uint32_t samples;
+    double rms;
+    double max;
+};
+
+/* sample the trace where the controller says, then rebuild it between the samples taken */
+static result_t replay(const std::vector<point_t> &trace, uint32_t min_ms, uint32_t max_ms, uint16_t threshold) {
+    AdaptiveRate rate;
+    rate.configure(min_ms, max_ms, threshold);
+
+    std::vector<size_t> taken;
+    uint32_t next_ms = trace[0].time_ms;
+    for (size_t i = 0; i < trace.size(); i++) {
+        if (trace[i].time_ms < next_ms) continue;
+        taken.push_back(i);
+        next_ms = trace[i].time_ms + rate.update(trace[i].value[0], trace[i].value[1], trace[i].value[2]);
+    }
+
+    result_t result = { (uint32_t) taken.size(), 0, 0 };
+    double sum = 0;
+    size_t k = 0;
+    for (size_t i = 0; i < trace.size(); i++) {
+        while (k + 1 < taken.size() && taken[k + 1] <= i) k++;
+        for (int c = 0; c < 3; c++) {
+            double estimate = trace[taken[k]].value[c];
+            if (k + 1 < taken.size()) {
+                const point_t &a = trace[taken[k]], &b = trace[taken[k + 1]];
+                double f = (double) (trace[i].time_ms - a.time_ms) / (b.time_ms - a.time_ms);
+                estimate = a.value[c] + f * (b.value[c] - a.value[c]);
+            }
+            double error = estimate - trace[i].value[c];
+            sum += error * error;
+            if (fabs(error) > result.max) result.max = fabs(error);
+        }
+    }
+    result.rms = sqrt(sum / (3.0 * trace.size()));
+    return result;
+}
+
+static void report(const char *name, const result_t &result, const result_t &reference) {
+    printf("%-28s %8u samples (%5.1f %%)  rms error %8.2f  max error %8.0f\n", name, (unsigned) result.samples,
+           100.0 * result.samples / reference.samples, result.rms, result.max);
+}
+
+int main(int argc, char **argv) {
+    std::vector<point_t> trace = argc > 1 && strcmp(argv[1], "-") != 0 ? load(argv[1]) : synthesize();
+    uint32_t min_ms = argc > 2 ? atoi(argv[2]) : 300;
+    uint32_t max_ms = argc > 3 ? atoi(argv[3]) : 1000;
+    uint16_t threshold = argc > 4 ? atoi(argv[4]) : 50;
+    uint32_t multiplier = argc > 5 ? atoi(argv[5]) : 2;
+    if (trace.size() < 2) {
+        printf("no trace\n");
+        return 1;
+    }
+
+    printf("trace: %u points over %.1f s\n", (unsigned) trace.size(),
+           (trace.back().time_ms - trace.front().time_ms) / 1000.0);
+    result_t fast = replay(trace, min_ms, min_ms, threshold);
+    char name[64];
+    snprintf(name, sizeof(name), "fixed %u ms", (unsigned) min_ms);
+    report(name, fast, fast);
+    snprintf(name, sizeof(name), "fixed %u ms", (unsigned) max_ms);
+    report(name, replay(trace, max_ms, max_ms, threshold), fast);
+    snprintf(name, sizeof(name), "adaptive %u..%u ms", (unsigned) min_ms, (unsigned) max_ms);
+    report(name, replay(trace, min_ms, max_ms, threshold), fast);
+    snprintf(name, sizeof(name), "adaptive %u..%u ms (x%u)", (unsigned) min_ms, (unsigned) (multiplier * max_ms),
+             (unsigned) multiplier);
+    report(name, replay(trace, min_ms, multiplier * max_ms, threshold), fast);
+    snprintf(name, sizeof(name), "adaptive %u..%u ms", (unsigned) min_ms, (unsigned) (10 * max_ms));
+    report(name, replay(trace, min_ms, 10 * max_ms, threshold), fast);
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Host bench for source/FlashLog.h on a simulated flash.
+ *
+ * Logs a day of samples at 1 Hz, reboots the log a few times on the way,
+ * then reports write amplification, wear spread, recovery cost, the cost
+ * of range queries and the largest unit of flash work done by one step().
+ * The log gets a single step() per sample, as from a busy event loop, and
+ * must not drop any. Sectors are erased in slices, 43 by default as 2 ms
+ * partial erases of an nRF52 page, and hold garbage until the last one.
+ * A cursor follows the samples as they are appended, as a central catching
+ * up does, and must read every one in order.
+ *
+ *   g++ -std=c++11 -O2 -I../source flash_log_bench.cpp -o flash_log_bench
+ *   ./flash_log_bench [sector size] [sectors] [samples] [erase slices]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "FlashLog.h"
+
+#define BLOCK_SIZE 128
+
+/* NOR flash: bits only go from 1 to 0 when programmed, a sector erase sets them back to 1 */
+class SimFlash {
+public:
+    SimFlash(uint32_t sector_size, uint32_t sectors, uint32_t slices) :
+        _sector_size(sector_size),
+        _memory(sector_size * sectors, 0xFF),
+        _erases(sectors, 0),
+        _programmed(0),
+        _largest_program(0),
+        _slices(slices),
+        _slice(0)
+    {
+    }
+
+    int read(void *buffer, uint32_t addr, uint32_t size) {
+        memcpy(buffer, &_memory[addr - START], size);
+        return 0;
+    }
+
+    int program(const void *buffer, uint32_t addr, uint32_t size) {
+        const uint8_t *data = (const uint8_t *) buffer;
+        for (uint32_t i = 0; i < size; i++) {
+            if (data[i] & ~_memory[addr - START + i]) {
+                printf("program over programmed byte at 0x%08x\n", (unsigned) (addr + i));
+                exit(1);
+            }
+            _memory[addr - START + i] &= data[i];
+        }
+        _programmed += size;
+        if (size > _largest_program) _largest_program = size;
+        return 0;
+    }
+
+    int erase(uint32_t addr, uint32_t size) {
+        memset(&_memory[addr - START], 0xFF, size);
+        _erases[(addr - START) / _sector_size]++;
+        return 0;
+    }
+
+    /* a partly erased sector reads as garbage */
+    bool erase_slice(uint32_t addr, uint32_t size) {
+        if (++_slice < _slices) {
+            memset(&_memory[addr - START], 0xA5, size);
+            return false;
+        }
+        _slice = 0;
+        erase(addr, size);
+        return true;
+    }
+
+    uint32_t get_sector_size(uint32_t) const { return _sector_size; }
+    uint32_t get_flash_start() const { return START; }
+    uint32_t get_flash_size() const { return _memory.size(); }
+    uint32_t get_page_size() const { return 4; }
+    uint8_t get_erase_value() const { return 0xFF; }
+
+    static const uint32_t START = 0x00040000;
+
+    uint32_t _sector_size;
+    std::vector<uint8_t> _memory;
+    std::vector<uint32_t> _erases;
+    uint64_t _programmed;
+    uint32_t _largest_program;
+    uint32_t _slices;
+    uint32_t _slice;
+};
+
+typedef FlashLog<SimFlash, BLOCK_SIZE> Log;
+
+static uint16_t light(uint32_t t, uint32_t seed) {
+    /* slow daylight swing with some sensor noise */
+    uint32_t phase = (t / 1000) % 86400;
+    uint32_t level = phase < 43200 ? phase : 86400 - phase;
+    return (uint16_t) (level + (seed * 2654435761u >> 28));
+}
+
+int main(int argc, char **argv) {
+    uint32_t sector_size = argc > 1 ? atoi(argv[1]) : 4096;
+    uint32_t sectors = argc > 2 ? atoi(argv[2]) : 8;
+    uint32_t samples = argc > 3 ? atoi(argv[3]) : 86400;
+    uint32_t slices = argc > 4 ? atoi(argv[4]) : 43;
+
+    SimFlash flash(sector_size, sectors, slices);
+    Log *log = new Log(flash);
+    uint32_t end = flash.get_flash_start() + flash.get_flash_size();
+    if (log->init(flash.get_flash_start(), end, sectors) != 0) {
+        printf("bad geometry\n");
+        return 1;
+    }
+
+    uint32_t uptime = 0;
+    uint32_t steps = 0;
+    uint32_t reboots = 0;
+    uint32_t recovery_reads = 0;
+    Log::cursor_t tail;
+    tail.valid = false;
+    uint32_t tail_next = 0;
+    uint32_t tail_read = 0;
+    uint32_t tail_seeks = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        uptime += 1000;
+        log->append(uptime, light(uptime, i), light(uptime, i + 1) / 2, light(uptime, i + 2) / 3);
+        if (log->pending()) {
+            log->step();
+            steps++;
+        }
+
+        /* read on from where the last call stopped, seeking only when the cursor has been dropped */
+        Log::record_t record;
+        if (!tail.valid) {
+            if (!log->seek(tail, tail_next, false)) {
+                continue;
+            }
+            tail_seeks++;
+        }
+        while (log->next(tail, record)) {
+            if (record.sequence != tail_next) {
+                printf("tail read %u after %u\n", (unsigned) record.sequence, (unsigned) tail_next - 1);
+                return 1;
+            }
+            tail_next = record.sequence + 1;
+            tail_read++;
+        }
+
+        /* reset now and then, the log must carry on where it was */
+        if (i % 20000 == 19999) {
+            /* every other one after a flush, which must keep the last sample */
+            bool flushed = i % 40000 == 39999;
+            if (flushed) {
+                log->flush();
+                while (log->pending()) {
+                    log->step();
+                    steps++;
+                }
+            }
+            uint32_t expected = log->end();
+            if (log->stats().dropped > 0) {
+                printf("%u samples dropped\n", (unsigned) log->stats().dropped);
+                return 1;
+            }
+            delete log;
+            log = new Log(flash);
+            log->init(flash.get_flash_start(), end, sectors);
+            recovery_reads += log->stats().reads;
+            /* the tail had read everything, it goes on past the numbers recovery skipped */
+            tail.valid = false;
+            tail_next = log->end();
+            reboots++;
+            uptime = 0;
+            /* samples still in the RAM block are lost on reset, their numbers must not be given again */
+            if (log->end() < expected) {
+                printf("recovered sequence %u before %u\n", (unsigned) log->end(), (unsigned) expected);
+                return 1;
+            }
+            Log::cursor_t last;
+            Log::record_t record;
+            if (flushed && !(log->seek(last, expected - 1, false) && log->next(last, record) && record.sequence == expected - 1)) {
+                printf("sample %u lost after a flush\n", (unsigned) (expected - 1));
+                return 1;
+            }
+        }
+    }
+
+    /* check every sample still held decodes in order */
+    Log::cursor_t cursor;
+    Log::record_t record;
+    std::vector<uint32_t> sequences;
+    if (log->seek(cursor, 0, false)) {
+        while (log->next(cursor, record)) {
+            if (!sequences.empty() && record.sequence <= sequences.back()) {
+                printf("sequence %u after %u\n", (unsigned) record.sequence, (unsigned) sequences.back());
+                return 1;
+            }
+            sequences.push_back(record.sequence);
+        }
+    }
+    uint32_t held = sequences.size();
+
+    /* seek to random sequence numbers in what is held, resets leave gaps between them */
+    uint32_t reads_before = log->stats().reads;
+    uint32_t queries = 1000;
+    for (uint32_t q = 0; q < queries; q++) {
+        uint32_t key = sequences[(q * 7919u) % held];
+        if (!log->seek(cursor, key, false) || !log->next(cursor, record) || record.sequence != key) {
+            printf("seek to %u failed\n", (unsigned) key);
+            return 1;
+        }
+    }
+    double reads_per_query = (double) (log->stats().reads - reads_before) / queries;
+
+    uint32_t min_erases = flash._erases[0], max_erases = flash._erases[0];
+    for (uint32_t s = 0; s < sectors; s++) {
+        if (flash._erases[s] < min_erases) min_erases = flash._erases[s];
+        if (flash._erases[s] > max_erases) max_erases = flash._erases[s];
+    }
+
+    double raw = (double) samples * 10;  // time and R, G, B as plain 32 and 16 bit values
+    printf("samples: %u, held: %u (%.1f h), reboots: %u\n", (unsigned) samples, (unsigned) held, held / 3600.0, (unsigned) reboots);
+    printf("programmed: %llu bytes, %.2f bytes per sample, write amplification vs raw: %.2f\n",
+           (unsigned long long) flash._programmed, flash._programmed / (double) samples, flash._programmed / raw);
+    printf("erases per sector: %u..%u\n", (unsigned) min_erases, (unsigned) max_erases);
+    printf("recovery: %.1f reads per boot\n", reboots ? recovery_reads / (double) reboots : 0.0);
+    printf("query: %.1f reads per seek\n", reads_per_query);
+    printf("step: %u calls, largest program %u bytes, erase 1/%u of %u bytes\n",
+           (unsigned) steps, (unsigned) flash._largest_program, (unsigned) slices, (unsigned) sector_size);
+    printf("tail: %u samples read, %u seeks\n", (unsigned) tail_read, (unsigned) tail_seeks);
+    delete log;
+    return 0;
+}
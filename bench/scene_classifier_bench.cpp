@@ -0,0 +1,77 @@
+/*
+ * Host bench for source/SceneClassifier.h.
+ *
+ * Makes up a model of lighting scenes, classifies noisy samples of them
+ * taken at random brightness, and reports the accuracy, the confidence and
+ * the time per classification on this machine.
+ *
+ *   g++ -std=c++11 -O2 -I../source scene_classifier_bench.cpp -o scene_classifier_bench
+ *   ./scene_classifier_bench [scenes] [samples]
+ *
+ * Cycles on the targets come from the firmware itself: built with
+ * app.scene-benchmark set, it counts the cycles of the same loop at boot
+ * and prints them per classification on the serial console. Cortex-M3 and
+ * up count them with the DWT; an M0 such as the NRF51_DK times the loop
+ * with a Timer and scales it by the core clock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "SceneClassifier.h"
+
+#define MAX_SCENES 8
+
+typedef SceneClassifier<MAX_SCENES> Classifier;
+
+int main(int argc, char **argv) {
+    uint8_t scenes = argc > 1 ? atoi(argv[1]) : 5;
+    uint32_t samples = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (scenes == 0 || scenes > MAX_SCENES) {
+        printf("1 to %u scenes\n", MAX_SCENES);
+        return 1;
+    }
+
+    /* scenes spread along a warm to cool white line and off it */
+    Classifier::model_t model;
+    model.count = scenes;
+    for (uint8_t i = 0; i < scenes; i++) {
+        model.centroids[i].r = 440 - 30 * i;
+        model.centroids[i].g = 360 + (i % 2 ? 25 : 0);
+    }
+    Classifier classifier(60, 40);
+    classifier.load(model);
+
+    srand(1);
+    uint32_t correct = 0, unknown = 0, confidence = 0;
+    uint8_t *expected = new uint8_t[samples];
+    uint16_t (*rgb)[3] = new uint16_t[samples][3];
+    for (uint32_t i = 0; i < samples; i++) {
+        uint8_t scene = rand() % scenes;
+        uint32_t brightness = 100 + rand() % 20000;
+        /* about 1 % chromaticity noise */
+        int32_t r = model.centroids[scene].r + (rand() % 21) - 10;
+        int32_t g = model.centroids[scene].g + (rand() % 21) - 10;
+        expected[i] = scene;
+        rgb[i][0] = brightness * r / Classifier::CHROMA_ONE;
+        rgb[i][1] = brightness * g / Classifier::CHROMA_ONE;
+        rgb[i][2] = brightness * (Classifier::CHROMA_ONE - r - g) / Classifier::CHROMA_ONE;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < samples; i++) {
+        uint8_t level;
+        uint8_t scene = classifier.classify(rgb[i][0], rgb[i][1], rgb[i][2], level);
+        if (scene == expected[i]) correct++;
+        if (scene == Classifier::UNKNOWN) unknown++;
+        confidence += level;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("scenes: %u, samples: %u\n", (unsigned) scenes, (unsigned) samples);
+    printf("correct: %.2f %%, unknown: %.2f %%, mean confidence: %.0f / 255\n",
+           100.0 * correct / samples, 100.0 * unknown / samples, (double) confidence / samples);
+    printf("host: %.1f ns per classification\n", ns / samples);
+    delete[] expected;
+    delete[] rgb;
+    return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef ADAPTIVE_RATE_H
+#define ADAPTIVE_RATE_H
+
+#include <stdint.h>
+
+/**
+ * Sampling period controller driven by how much the signal moves.
+ *
+ * Each channel keeps an exponential moving mean and variance (alpha 1/4).
+ * A sample is "active" when any channel moved from the previous sample, or
+ * its deviation from the mean has a variance, beyond threshold_permille of
+ * its level plus NOISE_FLOOR counts. An active sample drops the period to
+ * the fastest bound at once; after HOLD quiet samples in a row it grows by
+ * half each sample until it is back at the slowest bound.
+ *
+ * Only <stdint.h> is needed, so the replay bench can build it on the host.
+ */
+class AdaptiveRate {
+public:
+    /* counts added to the level before the threshold applies, keeps the dark from reading as activity */
+    static const uint16_t NOISE_FLOOR = 16;
+    /* quiet samples taken at the current period before it starts growing */
+    static const uint8_t HOLD = 4;
+
+    AdaptiveRate() {
+        configure(1000, 1000, 50);
+    }
+
+    /* new bounds in ms, the period starts at the slowest one; min_ms == max_ms samples at a fixed rate */
+    void configure(uint32_t min_ms, uint32_t max_ms, uint16_t threshold_permille) {
+        _min_ms = min_ms < max_ms ? min_ms : max_ms;
+        _max_ms = max_ms;
+        _threshold = threshold_permille;
+        _period_ms = max_ms;
+        _quiet = 0;
+        _primed = false;
+    }
+
+    /* feed the sample just taken, returns the period to the next one */
+    uint32_t update(uint16_t r, uint16_t g, uint16_t b) {
+        const uint16_t value[3] = { r, g, b };
+        bool active = false;
+        for (uint8_t c = 0; c < 3; c++) {
+            int32_t x = (int32_t) value[c] << FRACTION;
+            if (!_primed) {
+                _mean[c] = x;
+                _variance[c] = 0;
+                _last[c] = value[c];
+                continue;
+            }
+
+            int32_t deviation = x - _mean[c];
+            _mean[c] += deviation / 4;
+            _variance[c] += ((int64_t) deviation * deviation - _variance[c]) / 4;
+
+            /* all compared in counts << FRACTION */
+            int64_t threshold = ((int64_t) _mean[c] + ((int32_t) NOISE_FLOOR << FRACTION)) * _threshold / 1000;
+            int64_t step = ((int64_t) value[c] - _last[c]) << FRACTION;
+            if (step < 0) step = -step;
+            if (step > threshold || _variance[c] > threshold * threshold) {
+                active = true;
+            }
+            _last[c] = value[c];
+        }
+        _primed = true;
+
+        if (active) {
+            _period_ms = _min_ms;
+            _quiet = 0;
+        } else if (_quiet < HOLD) {
+            _quiet++;
+        } else {
+            uint32_t period = _period_ms + _period_ms / 2;
+            _period_ms = period > _max_ms || period < _period_ms ? _max_ms : period;
+        }
+        return _period_ms;
+    }
+
+    uint32_t period() const {
+        return _period_ms;
+    }
+
+private:
+    static const uint8_t FRACTION = 4;
+
+    uint32_t _min_ms;
+    uint32_t _max_ms;
+    uint16_t _threshold;
+    uint32_t _period_ms;
+    uint8_t _quiet;
+    bool _primed;
+    int32_t _mean[3];       // FRACTION fractional bits
+    int64_t _variance[3];   // 2 * FRACTION fractional bits
+    uint16_t _last[3];
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef BROADCAST_SAMPLE_H
+#define BROADCAST_SAMPLE_H
+
+#include <mbed.h>
+#include "ISL29125.h"
+#include "SensorConfig.h"
+
+/* broadcast mode: bits of the status byte */
+#define BROADCAST_STATUS_FRESH     0x01  // carries a sample, clear until the first conversion
+#define BROADCAST_STATUS_FILTERED  0x02  // values are exponentially averaged
+#define BROADCAST_STATUS_10KLX     0x04  // sensing range 10000 lux, 375 lux otherwise
+#define BROADCAST_STATUS_12BIT     0x08  // ADC resolution 12 bit, 16 bit otherwise
+
+/**
+ * The latest sample as broadcast mode advertises it: the low 16 bits of its
+ * acquisition sequence number, so scanners can match it with the samples a
+ * gateway downloads, a status byte, then R, G and B, all little endian.
+ * With MBED_CONF_APP_BROADCAST_FILTER_SHIFT set the values are an
+ * exponential moving average of the samples rather than the last one.
+ */
+class BroadcastSample {
+public:
+    static const uint8_t SIZE = 9;
+
+    BroadcastSample() :
+        _primed(false)
+    {
+        memset(_filtered, 0, sizeof(_filtered));
+    }
+
+    /* lay out a sample just taken with `config` in SIZE bytes at `p` */
+    void encode(const SensorConfig &config, uint16_t sequence, uint16_t r, uint16_t g, uint16_t b, uint8_t *p) {
+        /* the sensor is programmed from the configuration, no need to read its settings back over I2C */
+        uint8_t status = BROADCAST_STATUS_FRESH;
+        if (config.range == ISL29125_10KLX) status |= BROADCAST_STATUS_10KLX;
+        if (config.resolution == ISL29125_12BIT) status |= BROADCAST_STATUS_12BIT;
+
+        if (MBED_CONF_APP_BROADCAST_FILTER_SHIFT > 0) {
+            filter(r, g, b);
+            status |= BROADCAST_STATUS_FILTERED;
+            r = _filtered[0] >> 8;
+            g = _filtered[1] >> 8;
+            b = _filtered[2] >> 8;
+        }
+
+        p[0] = sequence & 0xFF; p[1] = sequence >> 8;
+        p[2] = status;
+        p[3] = r & 0xFF; p[4] = r >> 8;
+        p[5] = g & 0xFF; p[6] = g >> 8;
+        p[7] = b & 0xFF; p[8] = b >> 8;
+    }
+
+private:
+    /* exponential moving average with alpha = 1 / 2^shift, values kept with 8 fractional bits */
+    void filter(uint16_t r, uint16_t g, uint16_t b) {
+        const int32_t sample[3] = { (int32_t) r << 8, (int32_t) g << 8, (int32_t) b << 8 };
+        for (uint8_t i = 0; i < 3; i++) {
+            if (!_primed) {
+                _filtered[i] = sample[i];
+            } else {
+                _filtered[i] += (sample[i] - _filtered[i]) >> MBED_CONF_APP_BROADCAST_FILTER_SHIFT;
+            }
+        }
+        _primed = true;
+    }
+
+    bool _primed;
+    int32_t _filtered[3];
+};
+
+#endif
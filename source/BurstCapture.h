@@ -0,0 +1,157 @@
+#ifndef BURST_CAPTURE_H
+#define BURST_CAPTURE_H
+
+#include <mbed.h>
+
+/**
+ * Oscilloscope style capture of one channel into a RAM ring.
+ *
+ * Once armed, every sample goes into a ring of MBED_CONF_APP_BURST_DEPTH
+ * values. The trigger is only looked for once `pre` samples are held; when
+ * it fires, `post` more samples are taken, the trigger sample being the
+ * first of them, and the ring is frozen. The capture is then the `pre`
+ * samples before the trigger followed by the `post` from it on.
+ */
+class BurstCapture {
+public:
+    enum state_t {
+        IDLE,
+        ARMED,      // filling the pre-trigger part, looking for the trigger
+        TRIGGERED,  // filling the post-trigger part
+        DONE        // frozen until armed again
+    };
+
+    enum trigger_t {
+        RISING,     // crosses threshold upwards
+        FALLING,    // crosses threshold downwards
+        SLOPE       // changes by at least threshold from one sample to the next
+    };
+
+    struct settings_t {
+        uint8_t channel;    // ISL29125_R, ISL29125_G or ISL29125_B
+        uint8_t trigger;    // trigger_t
+        uint16_t threshold;
+        uint16_t pre;
+        uint16_t post;
+    };
+
+    BurstCapture() :
+        _state(IDLE),
+        _forced(false)
+    {
+        memset(&_settings, 0, sizeof(_settings));
+    }
+
+    /* start filling the ring, false if the settings are not valid */
+    bool arm(const settings_t &settings) {
+        if (settings.trigger > SLOPE || settings.post == 0 ||
+            (uint32_t) settings.pre + settings.post > MBED_CONF_APP_BURST_DEPTH) {
+            return false;
+        }
+        _settings = settings;
+        _state = ARMED;
+        _forced = false;
+        _head = 0;
+        _filled = 0;
+        _added = 0;
+        return true;
+    }
+
+    void disarm() {
+        _state = IDLE;
+    }
+
+    /* trigger on the next sample whatever its value */
+    void force() {
+        if (_state == ARMED) {
+            _forced = true;
+        }
+    }
+
+    /* add a sample, true when it completes the capture */
+    bool add(uint16_t value) {
+        if (_state != ARMED && _state != TRIGGERED) {
+            return false;
+        }
+
+        bool trigger = false;
+        if (_state == ARMED && _filled >= _settings.pre && _filled > 0) {
+            uint16_t last = _samples[(_head + MBED_CONF_APP_BURST_DEPTH - 1) % MBED_CONF_APP_BURST_DEPTH];
+            switch (_settings.trigger) {
+                case RISING:
+                    trigger = last < _settings.threshold && value >= _settings.threshold;
+                    break;
+                case FALLING:
+                    trigger = last > _settings.threshold && value <= _settings.threshold;
+                    break;
+                case SLOPE:
+                    trigger = (value > last ? value - last : last - value) >= _settings.threshold;
+                    break;
+            }
+        }
+        if (_state == ARMED && _filled >= _settings.pre && _forced) {
+            trigger = true;
+        }
+
+        _samples[_head] = value;
+        _head = (_head + 1) % MBED_CONF_APP_BURST_DEPTH;
+        if (_filled < MBED_CONF_APP_BURST_DEPTH) {
+            _filled++;
+        }
+        _added++;
+
+        if (trigger) {
+            _state = TRIGGERED;
+            _post_left = _settings.post;
+        }
+        if (_state == TRIGGERED && --_post_left == 0) {
+            _state = DONE;
+            return true;
+        }
+        return false;
+    }
+
+    state_t state() const {
+        return _state;
+    }
+
+    bool capturing() const {
+        return _state == ARMED || _state == TRIGGERED;
+    }
+
+    /* the trigger was forced rather than met */
+    bool forced() const {
+        return _forced;
+    }
+
+    const settings_t &settings() const {
+        return _settings;
+    }
+
+    /* samples in the capture, pre-trigger ones included */
+    uint16_t count() const {
+        return _settings.pre + _settings.post;
+    }
+
+    /* samples taken since the capture was armed */
+    uint32_t added() const {
+        return _added;
+    }
+
+    /* sample i of a finished capture, the trigger sample is i = settings().pre */
+    uint16_t at(uint16_t i) const {
+        return _samples[(_head + MBED_CONF_APP_BURST_DEPTH - count() + i) % MBED_CONF_APP_BURST_DEPTH];
+    }
+
+private:
+    state_t _state;
+    settings_t _settings;
+    bool _forced;
+    uint16_t _samples[MBED_CONF_APP_BURST_DEPTH];
+    uint16_t _head;
+    uint16_t _filled;
+    uint16_t _post_left;
+    uint32_t _added;
+};
+
+#endif
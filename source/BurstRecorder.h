@@ -0,0 +1,163 @@
+#ifndef BURST_RECORDER_H
+#define BURST_RECORDER_H
+
+#include <mbed.h>
+#include <events/mbed_events.h>
+#include "ISL29125.h"
+#include "RGBService.h"
+#include "BurstCapture.h"
+
+/**
+ * Burst capture on the burst characteristic: one channel taken by the
+ * application at the sensor's fastest rate into a BurstCapture, forced if
+ * the trigger has not come after MBED_CONF_APP_BURST_TIMEOUT_MS. A finished
+ * capture goes to each subscriber as an info frame, its samples, then an
+ * empty frame; each link keeps where its upload is, as an index into the
+ * capture or IDLE or INFO.
+ */
+class BurstRecorder {
+public:
+    /* upload position of a link with no capture to send, and of one about to get the info frame */
+    static const uint16_t IDLE = 0xFFFF;
+    static const uint16_t INFO = 0xFFFE;
+
+    BurstRecorder(RGBService &service, events::EventQueue &event_queue) :
+        _service(service),
+        _event_queue(event_queue),
+        _timeout(0),
+        _range(ISL29125_10KLX),
+        _first_us(0),
+        _time(0),
+        _period_us(0)
+    {
+    }
+
+    /* read the channel 0: R, 1: G or 2: B, trigger, threshold, pre- and post-trigger samples of an arm
+     * request, false if there is no such channel */
+    static bool decode(const uint8_t *p, BurstCapture::settings_t &settings) {
+        static const uint8_t channels[3] = { ISL29125_R, ISL29125_G, ISL29125_B };
+        if (p[0] > 2) {
+            return false;
+        }
+        settings.channel = channels[p[0]];
+        settings.trigger = p[1];
+        settings.threshold = p[2] | (p[3] << 8);
+        settings.pre = p[4] | (p[5] << 8);
+        settings.post = p[6] | (p[7] << 8);
+        return true;
+    }
+
+    /* start a capture at the sensor range `range`, false if the settings are not valid; the caller then converts
+     * sensorChannel() at the fastest rate and hands each conversion to add() */
+    bool arm(const BurstCapture::settings_t &settings, uint8_t range) {
+        if (!_capture.arm(settings)) {
+            return false;
+        }
+        _range = range;
+        _timeout = _event_queue.call_in(MBED_CONF_APP_BURST_TIMEOUT_MS, this, &BurstRecorder::force);
+        printf("Burst capture armed, %u + %u samples\r\n", settings.pre, settings.post);
+        return true;
+    }
+
+    /* stop waiting for the trigger, the caller stops fast sampling */
+    void disarm() {
+        _capture.disarm();
+        cancelTimeout();
+    }
+
+    bool capturing() const {
+        return _capture.capturing();
+    }
+
+    /* there is a finished capture to send */
+    bool done() const {
+        return _capture.state() == BurstCapture::DONE;
+    }
+
+    /* ISL29125 mode of the channel being captured */
+    uint8_t sensorChannel() const {
+        return _capture.settings().channel;
+    }
+
+    /* a conversion taken at `now_us`, `time_ms` in log time; true when it completes the capture, the caller then
+     * stops fast sampling and sets the subscribers' uploads to INFO */
+    bool add(uint16_t value, uint32_t now_us, uint32_t time_ms) {
+        if (_capture.added() == 0) {
+            _first_us = now_us;
+        }
+
+        bool armed = _capture.state() == BurstCapture::ARMED;
+        bool done = _capture.add(value);
+        if (armed && _capture.state() != BurstCapture::ARMED) {
+            _time = time_ms;
+        }
+        if (!done) {
+            return false;
+        }
+        _period_us = _capture.added() > 1 ? (now_us - _first_us) / (_capture.added() - 1) : 0;
+        cancelTimeout();
+        printf("Burst capture done, %lu us per sample%s\r\n",
+               (unsigned long) _period_us, _capture.forced() ? ", trigger forced" : "");
+        return true;
+    }
+
+    /* send what a link's upload at `next` has left while its transmit queue has room, in frames of `payload` bytes */
+    void pump(uint16_t &next, TxScheduler &tx, uint16_t payload) {
+        uint16_t per_frame = (payload - RGBService::BURST_HEADER_SIZE) / sizeof(uint16_t);
+        uint16_t count = _capture.count();
+        uint8_t frame[RGBService::STREAM_MAX_PAYLOAD];
+        while (next != IDLE && tx.ready()) {
+            if (next == INFO) {
+                const BurstCapture::settings_t &settings = _capture.settings();
+                frame[0] = 0xFF; frame[1] = 0xFF;
+                frame[2] = settings.channel == ISL29125_R ? 0 : settings.channel == ISL29125_G ? 1 : 2;
+                frame[3] = (_capture.forced() ? 0x01 : 0) | (_range == ISL29125_10KLX ? 0x02 : 0);
+                frame[4] = count & 0xFF; frame[5] = count >> 8;
+                frame[6] = settings.pre & 0xFF; frame[7] = settings.pre >> 8;
+                frame[8] = _period_us & 0xFF; frame[9] = _period_us >> 8;
+                put32(&frame[10], _time);
+                _service.updateBurst(tx, frame, RGBService::BURST_INFO_SIZE);
+                next = 0;
+                continue;
+            }
+
+            frame[0] = next & 0xFF; frame[1] = next >> 8;
+            uint8_t *p = frame + RGBService::BURST_HEADER_SIZE;
+            uint16_t sent = 0;
+            while (sent < per_frame && next < count) {
+                uint16_t value = _capture.at(next++);
+                p[0] = value & 0xFF; p[1] = value >> 8;
+                p += sizeof(uint16_t);
+                sent++;
+            }
+            if (sent == 0) {
+                next = IDLE;
+            }
+            _service.updateBurst(tx, frame, p - frame);
+        }
+    }
+
+private:
+    void force() {
+        _timeout = 0;
+        _capture.force();
+    }
+
+    void cancelTimeout() {
+        _event_queue.cancel(_timeout);
+        _timeout = 0;
+    }
+
+    RGBService &_service;
+    events::EventQueue &_event_queue;
+    BurstCapture _capture;
+    int _timeout;
+    uint8_t _range;             // sensor range the capture was armed at
+    uint32_t _first_us;
+    uint32_t _time;             // log time of the trigger
+    uint16_t _period_us;        // mean time between the samples of the capture
+};
+
+static_assert(MBED_CONF_APP_BURST_DEPTH < BurstRecorder::INFO, "burst indexes must stay clear of IDLE and INFO");
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <mbed.h>
+#include <stddef.h>
+#include <type_traits>
+#include "ColourCorrection.h"
+
+/**
+ * All a device learns at the factory station in one record: the dark
+ * offset and gain of each channel, the colour correction matrix and the
+ * sensor's active IR compensation.
+ *
+ * The record is the same bytes in RAM, in the KVStore and on the
+ * calibration characteristic: 16 bit fields in the targets' little endian
+ * order and no padding, which the asserts below pin down. Boot is a single
+ * kv_get straight into it, and a record from the station is checked and
+ * saved as it arrived. It starts with a magic and a version, so a later
+ * layout can tell this one apart, and ends with the CRC-16/CCITT of all the
+ * bytes before it, so a record torn by a reset or mangled on the way is
+ * refused whole.
+ *
+ * Gains are folded into the matrix columns when the record is applied, so a
+ * sample still costs the dark subtraction and the matrix multiply and
+ * nothing more.
+ */
+struct Calibration {
+    static const uint16_t MAGIC = 0xCA1B;
+    static const uint8_t VERSION = 1;
+    static const uint16_t GAIN_ONE = 1 << ColourCorrection::FRACTION;
+    static const uint8_t IRCOMP_DEFAULT = 0xBF;     // what the ISL29125 driver programs at reset
+
+    uint16_t magic;
+    uint8_t version;
+    uint8_t ircomp;         // ISL29125 active IR compensation, 0..63 or 128..191
+    uint16_t gain[3];       // R, G, B, ColourCorrection::FRACTION fractional bits
+    ColourCorrection::calibration_t correction;
+    uint16_t crc;
+
+    /* what an uncalibrated device uses: unity gains and the sRGB matrix */
+    static Calibration defaults() {
+        Calibration calibration;
+        calibration.magic = MAGIC;
+        calibration.version = VERSION;
+        calibration.ircomp = IRCOMP_DEFAULT;
+        for (uint8_t c = 0; c < 3; c++) {
+            calibration.gain[c] = GAIN_ONE;
+        }
+        calibration.correction = ColourCorrection::srgb();
+        calibration.seal();
+        return calibration;
+    }
+
+    uint16_t checksum() const {
+        MbedCRC<POLY_16BIT_CCITT, 16> ct;
+        uint32_t crc = 0;
+        ct.compute((void *) this, offsetof(Calibration, crc), &crc);
+        return crc;
+    }
+
+    void seal() {
+        crc = checksum();
+    }
+
+    /* false unless this is an intact record of this version that folds into a usable matrix */
+    bool valid() const {
+        ColourCorrection::calibration_t folded;
+        return magic == MAGIC && version == VERSION && crc == checksum() &&
+               (ircomp <= 63 || (ircomp >= 128 && ircomp <= 191)) &&
+               fold(folded) && ColourCorrection::valid(folded);
+    }
+
+    /* the correction with each column scaled by its channel's gain, false if a coefficient outgrows 16 bit */
+    bool fold(ColourCorrection::calibration_t &folded) const {
+        folded.dark[0] = correction.dark[0];
+        folded.dark[1] = correction.dark[1];
+        folded.dark[2] = correction.dark[2];
+        for (uint8_t row = 0; row < 3; row++) {
+            for (uint8_t column = 0; column < 3; column++) {
+                int32_t c = (int32_t) correction.matrix[row][column] * gain[column];
+                c = (c + (1 << (ColourCorrection::FRACTION - 1))) >> ColourCorrection::FRACTION;
+                if (c < INT16_MIN || c > INT16_MAX) {
+                    return false;
+                }
+                folded.matrix[row][column] = c;
+            }
+        }
+        return true;
+    }
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the calibration record is kept and sent in memory order, which must be little endian"
+#endif
+static_assert(std::is_standard_layout<Calibration>::value, "the calibration record is copied as bytes");
+static_assert(offsetof(Calibration, gain) == 4 && offsetof(Calibration, correction) == 10 &&
+              offsetof(Calibration, crc) == 34 && sizeof(Calibration) == 36,
+              "the calibration record layout is part of the protocol");
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef CALIBRATOR_H
+#define CALIBRATOR_H
+
+#include <mbed.h>
+#include "ISL29125.h"
+#include "RGBService.h"
+#include "Calibration.h"
+#include "ColourCorrection.h"
+#include "storage.h"
+
+/**
+ * The device's calibration record and what it feeds: the sensor's IR
+ * compensation and the colour correction behind the XYZ characteristic.
+ * The record is kept in KVStore as the factory station wrote it; a missing,
+ * torn or older one leaves the device uncalibrated, on defaults.
+ */
+class Calibrator {
+public:
+    Calibrator(RGBService &service, ISL29125 &sensor) :
+        _service(service),
+        _sensor(sensor)
+    {
+        memset(_xyz, 0, sizeof(_xyz));
+    }
+
+    /* boot with the stored record, read straight into place */
+    void start() {
+        Calibration calibration;
+        if (!storage_load(STORAGE_KEY("calibration"), calibration) || !calibration.valid()) {
+            printf("No valid calibration, using defaults\r\n");
+            calibration = Calibration::defaults();
+        }
+        apply(calibration);
+    }
+
+    /* CIE XYZ and xy of a new sample, packed for the XYZ characteristic */
+    void update(uint16_t r, uint16_t g, uint16_t b) {
+        ColourCorrection::xyz_t xyz;
+        _ccm.convert(r, g, b, xyz);
+        const uint16_t values[5] = { xyz.X, xyz.Y, xyz.Z, xyz.x, xyz.y };
+        for (uint8_t i = 0; i < 5; i++) {
+            _xyz[2 * i] = values[i] & 0xFF;
+            _xyz[2 * i + 1] = values[i] >> 8;
+        }
+        _service.setXYZ(_xyz);
+    }
+
+    void notify(TxScheduler &tx, uint16_t payload) {
+        _service.updateXYZ(tx, _xyz);
+    }
+
+    /* reply to a record write from a central allowed to make it: the station seals the record with its CRC,
+     * so anything but an intact current one is refused */
+    void authorize(GattWriteAuthCallbackParams *params) {
+        Calibration calibration;
+        if (params->offset != 0 || params->len != RGBService::CALIBRATION_SIZE) {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+        } else {
+            memcpy(&calibration, params->data, sizeof(calibration));
+            params->authorizationReply = calibration.valid() ?
+                AUTH_CALLBACK_REPLY_SUCCESS : AUTH_CALLBACK_REPLY_ATTERR_OUT_OF_RANGE;
+        }
+    }
+
+    /* a record write went through authorize(), it is applied and stored as it came */
+    void written(const uint8_t *data) {
+        Calibration calibration;
+        memcpy(&calibration, data, sizeof(calibration));
+        apply(calibration);
+        storage_save(STORAGE_KEY("calibration"), calibration);
+    }
+
+private:
+    /* program the sensor and the colour correction with a valid record, and show it to clients */
+    void apply(const Calibration &calibration) {
+        ColourCorrection::calibration_t folded;
+        calibration.fold(folded);
+        _ccm.load(folded);
+        _sensor.IRcomp(calibration.ircomp);
+        _service.setCalibration(calibration);
+    }
+
+    RGBService &_service;
+    ISL29125 &_sensor;
+    ColourCorrection _ccm;
+    uint8_t _xyz[RGBService::XYZ_SIZE]; // latest calibrated sample, as sent
+};
+
+#endif
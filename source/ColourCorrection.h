@@ -0,0 +1,126 @@
+#ifndef COLOUR_CORRECTION_H
+#define COLOUR_CORRECTION_H
+
+#include <mbed.h>
+
+/**
+ * Per-device colour correction from sensor R, G, B counts to CIE XYZ and
+ * xy chromaticity, in fixed point.
+ *
+ * The dark offset of each channel is taken off first, then a 3x3 matrix
+ * with FRACTION fractional bits maps the counts to X, Y, Z in the same
+ * count scale. Inputs go in halved, as signed 16 bit, so each row is two
+ * dual 16 bit multiply-accumulates (__SMLAD) on cores with the DSP
+ * extension, the Cortex-M4 of the F401, and three plain ones elsewhere. A
+ * row's coefficients may add up in magnitude to 65535 at most, which keeps
+ * the 32 bit accumulator from overflowing whatever the input.
+ *
+ * Until a device is calibrated the matrix is the one from linear sRGB to
+ * XYZ under D65, treating the counts as linear sRGB.
+ */
+class ColourCorrection {
+public:
+    static const uint8_t FRACTION = 12;
+
+    struct calibration_t {
+        int16_t matrix[3][3];   // rows X, Y, Z, columns R, G, B, FRACTION fractional bits
+        uint16_t dark[3];       // counts of R, G, B in the dark
+    };
+
+    struct xyz_t {
+        uint16_t X;
+        uint16_t Y;
+        uint16_t Z;
+        uint16_t x;     // chromaticity, 16 fractional bits
+        uint16_t y;
+    };
+
+    ColourCorrection() {
+        load(srgb());
+    }
+
+    /* linear sRGB to XYZ under D65, no dark offsets */
+    static const calibration_t &srgb() {
+        static const calibration_t srgb = {
+            { { 1689, 1465, 739 }, { 871, 2929, 296 }, { 79, 488, 3893 } },
+            { 0, 0, 0 }
+        };
+        return srgb;
+    }
+
+    /* false if a row could overflow the accumulator */
+    static bool valid(const calibration_t &calibration) {
+        for (uint8_t row = 0; row < 3; row++) {
+            uint32_t sum = 0;
+            for (uint8_t column = 0; column < 3; column++) {
+                int32_t c = calibration.matrix[row][column];
+                sum += c < 0 ? -c : c;
+            }
+            if (sum > 0xFFFF) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void load(const calibration_t &calibration) {
+        _calibration = calibration;
+        for (uint8_t row = 0; row < 3; row++) {
+            const int16_t *m = calibration.matrix[row];
+            _packed[row][0] = pack(m[0], m[1]);
+            _packed[row][1] = pack(m[2], 0);
+        }
+    }
+
+    const calibration_t &calibration() const {
+        return _calibration;
+    }
+
+    void convert(uint16_t r, uint16_t g, uint16_t b, xyz_t &xyz) const {
+        const uint16_t raw[3] = { r, g, b };
+        int32_t v[3];
+        for (uint8_t c = 0; c < 3; c++) {
+            v[c] = raw[c] > _calibration.dark[c] ? (raw[c] - _calibration.dark[c]) >> 1 : 0;
+        }
+        const uint32_t rg = pack(v[0], v[1]);
+        const uint32_t b0 = pack(v[2], 0);
+
+        uint16_t out[3];
+        for (uint8_t row = 0; row < 3; row++) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+            int32_t sum = __SMLAD(rg, _packed[row][0], __SMLAD(b0, _packed[row][1], 0));
+#else
+            (void) rg;
+            (void) b0;
+            const int16_t *m = _calibration.matrix[row];
+            int32_t sum = m[0] * v[0] + m[1] * v[1] + m[2] * v[2];
+#endif
+            /* halved inputs: one fractional bit less to drop */
+            sum >>= FRACTION - 1;
+            out[row] = sum < 0 ? 0 : sum > 0xFFFF ? 0xFFFF : sum;
+        }
+
+        xyz.X = out[0];
+        xyz.Y = out[1];
+        xyz.Z = out[2];
+        uint32_t total = (uint32_t) out[0] + out[1] + out[2];
+        xyz.x = total ? chromaticity(out[0], total) : 0;
+        xyz.y = total ? chromaticity(out[1], total) : 0;
+    }
+
+private:
+    /* two signed 16 bit values in the halves of a word, as __SMLAD takes them */
+    static uint32_t pack(int32_t low, int32_t high) {
+        return ((uint32_t) (uint16_t) low) | ((uint32_t) (uint16_t) high << 16);
+    }
+
+    static uint16_t chromaticity(uint16_t part, uint32_t total) {
+        uint32_t value = ((uint32_t) part << 16) / total;
+        return value > 0xFFFF ? 0xFFFF : value;
+    }
+
+    calibration_t _calibration;
+    uint32_t _packed[3][2];     // coefficient pairs of each row for __SMLAD
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef COUNTER_PUBLISHER_H
+#define COUNTER_PUBLISHER_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "TxScheduler.h"
+
+/**
+ * Acquisition and delivery counters on the counters characteristic: where
+ * the samples went, not taken by the sensor, held back by the firmware or
+ * lost on the link. The sensor reads are counted for the whole device, the
+ * stream of each link in its own counts_t next to the TxScheduler, which
+ * counts the samples it dropped and sent.
+ */
+class CounterPublisher {
+public:
+    struct counts_t {
+        uint32_t suppressed;    // stream samples held back while the link caught up on the history
+        uint32_t queued;        // stream samples handed to the TxScheduler
+        uint32_t retransmitted; // reliable stream samples sent again for want of an ACK
+    };
+
+    CounterPublisher(RGBService &service) :
+        _service(service),
+        _acquired(0),
+        _missed(0)
+    {
+    }
+
+    /* a sensor read with a new sample */
+    void acquired() {
+        _acquired++;
+    }
+
+    /* a sensor read without one */
+    void missed() {
+        _missed++;
+    }
+
+    static void reset(counts_t &counts) {
+        memset(&counts, 0, sizeof(counts));
+    }
+
+    /* set the counters of a link, `newest` being the number of the last sample, notified to it if it subscribed */
+    void publish(const counts_t &counts, uint32_t newest, TxScheduler &tx, uint16_t payload, bool subscribed) {
+        const TxScheduler::stats_t &stats = tx.stats();
+        uint8_t value[RGBService::COUNTERS_SIZE];
+        put32(&value[0], newest);
+        put32(&value[4], _acquired);
+        put32(&value[8], _missed);
+        put32(&value[12], counts.suppressed);
+        put32(&value[16], counts.queued);
+        put32(&value[20], stats.items_dropped);
+        put32(&value[24], stats.items_sent);
+        put32(&value[28], counts.retransmitted);
+        _service.updateCounters(tx, payload, subscribed, value);
+    }
+
+private:
+    RGBService &_service;
+    uint32_t _acquired;         // samples read from the sensor since boot
+    uint32_t _missed;           // sensor reads without a new sample
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef EVENT_PUBLISHER_H
+#define EVENT_PUBLISHER_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "LightEventDetector.h"
+
+/**
+ * Light events on the event characteristic. Each sample goes through the
+ * detector; the events it completes are kept, in order, for the caller to
+ * notify, and the last of them is the value clients read.
+ */
+class EventPublisher {
+public:
+    EventPublisher(RGBService &service) :
+        _service(service),
+        _count(0)
+    {
+    }
+
+    /* feed a sample, true when it completed events, for the caller to notify */
+    bool update(uint32_t time_ms, uint16_t r, uint16_t g, uint16_t b) {
+        LightEventDetector::event_t events[LightEventDetector::MAX_EVENTS];
+        _count = _detector.add(time_ms, r, g, b, events);
+        for (uint8_t e = 0; e < _count; e++) {
+            uint8_t *value = _values[e];
+            value[0] = events[e].type;
+            put32(&value[1], events[e].time_ms);
+            value[5] = events[e].before & 0xFF; value[6] = events[e].before >> 8;
+            value[7] = events[e].after & 0xFF; value[8] = events[e].after >> 8;
+            _service.setEvent(value, RGBService::EVENT_SIZE);
+            printf("Event %u: %u -> %u\r\n", events[e].type, events[e].before, events[e].after);
+        }
+        return _count > 0;
+    }
+
+    /* send the events of the last sample to a subscriber, each in a notification of its own */
+    void notify(TxScheduler &tx, uint16_t payload) {
+        for (uint8_t e = 0; e < _count; e++) {
+            _service.notifyEvent(tx, _values[e], RGBService::EVENT_SIZE);
+        }
+    }
+
+private:
+    RGBService &_service;
+    LightEventDetector _detector;
+    uint8_t _values[LightEventDetector::MAX_EVENTS][RGBService::EVENT_SIZE];
+    uint8_t _count;             // events completed by the last sample
+};
+
+#endif
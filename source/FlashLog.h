@@ -0,0 +1,786 @@
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Append-only log of RGB samples in a range of internal flash sectors.
+ *
+ * The log area is split into equal sectors used as a ring: the head sector
+ * takes new blocks until it is full, then the next one becomes the head.
+ * That sector, the oldest, is only erased once the head has no free slot
+ * left, so the log keeps all but one of its sectors at any time. Every
+ * sector is erased once per turn of the ring, which levels the wear.
+ *
+ * Each sector starts with a header slot, followed by fixed size block
+ * slots. A block holds a run of samples, each one coded as zigzag varint
+ * deltas from the previous one (time as the change of the time step), and
+ * its header carries the sequence number and time of its first sample. As
+ * slots are fixed size and filled in order, a block is found by a binary
+ * search over the headers of one sector, itself picked from a RAM table of
+ * the first block of every sector; recovery on boot is the same search for
+ * the first erased slot of the head sector.
+ *
+ * Blocks are filled in RAM. A full block is programmed a chunk at a time,
+ * and the next sector erased, by step(), so the application can spread the
+ * flash work over its event loop. append() never waits on that work: a full
+ * block goes to a second buffer until step() has its slot ready, and new
+ * samples go on into the open block; only if that one fills too before the
+ * application has run step() through are samples left out of the log,
+ * counted as dropped. An erase stops the CPU on most parts, so sectors
+ * larger than MAX_SECTOR_SIZE are refused, and there must be at least
+ * MIN_SECTORS of them for a turn of the ring to keep some history. The
+ * driver erases a sector in slices, one per step(), where the part can
+ * (about 43 steps of 2 ms for an nRF52 page), and in one step otherwise,
+ * the CPU then stalling for the whole erase. The sector is out of reads
+ * from its first slice.
+ *
+ * A reset loses the blocks still in RAM, whose samples may have been sent
+ * on already, so recovery numbers on from past the most samples they could
+ * hold: no sequence number is given twice as long as none was dropped.
+ *
+ * Times are "log time": ms since boot plus the time of the last sample
+ * found on boot, 64 bit so they keep increasing across resets for good.
+ *
+ * Flash is the flash driver, LogFlash on target, any class with the same
+ * read/program/erase_slice and geometry methods on the host.
+ */
+template<typename Flash, uint16_t BLOCK_SIZE>
+class FlashLog {
+public:
+    struct record_t {
+        uint32_t sequence;
+        uint64_t time_ms;
+        uint16_t r;
+        uint16_t g;
+        uint16_t b;
+    };
+
+    struct stats_t {
+        uint32_t samples;           // samples appended since boot
+        uint32_t blocks;            // blocks programmed since boot
+        uint32_t programmed_bytes;  // bytes written to flash, headers and padding included
+        uint32_t erases;            // sectors erased since boot
+        uint32_t reads;             // flash reads, recovery and queries included
+        uint32_t dropped;           // samples left out, both block buffers being full
+    };
+
+    /* read position, kept by the caller between next() calls */
+    struct cursor_t {
+        uint8_t sector;
+        uint16_t slot;
+        uint8_t block[BLOCK_SIZE];
+        uint16_t offset;
+        uint16_t index;
+        record_t last;
+        int32_t last_step;
+        bool valid;
+        bool open;              // block was still in RAM when read, it may have grown or moved since
+    };
+
+    static const uint16_t HEADER_SIZE = 16;
+    static const uint16_t PROGRAM_CHUNK = 32;
+    static const uint8_t MIN_SECTORS = 3;
+    static const uint8_t MAX_SECTORS = 32;
+    static const uint32_t MAX_SECTOR_SIZE = 4096;
+
+    FlashLog(Flash &flash) :
+        _flash(flash),
+        _ready(false),
+        _erase_sector(-1),
+        _erasing(false),
+        _next_sequence(0),
+        _time_base(0),
+        _open_count(0),
+        _full_waiting(false),
+        _flush_pending(false),
+        _sealed_len(0),
+        _sealed_done(0)
+    {
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    /**
+     * Take the `sectors` sectors right below `end`, none of them below `floor`,
+     * and recover the log found there; 0 on success, -1 if they do not fit or
+     * are too large or too few.
+     */
+    int init(uint32_t floor, uint32_t end, uint8_t sectors) {
+        uint32_t flash_end = _flash.get_flash_start() + _flash.get_flash_size();
+        if (end <= floor || end > flash_end || floor < _flash.get_flash_start()) {
+            return -1;
+        }
+        _sector_size = _flash.get_sector_size(end - 1);
+        _page_size = _flash.get_page_size();
+        _erase_value = _flash.get_erase_value();
+        _sectors = sectors;
+        _slots = _sector_size / BLOCK_SIZE;
+
+        if (sectors < MIN_SECTORS || sectors > MAX_SECTORS || _sector_size > MAX_SECTOR_SIZE || _slots < 2 ||
+            (uint32_t) sectors * _sector_size > end - floor || (end - _flash.get_flash_start()) % _sector_size != 0 ||
+            BLOCK_SIZE % _page_size != 0 || PROGRAM_CHUNK % _page_size != 0) {
+            return -1;
+        }
+        _start = end - (uint32_t) sectors * _sector_size;
+        for (uint8_t i = 0; i < sectors; i++) {
+            if (_flash.get_sector_size(sectorAddress(i)) != _sector_size) {
+                return -1;
+            }
+        }
+
+        recover();
+        _ready = true;
+        return 0;
+    }
+
+    bool ready() const {
+        return _ready;
+    }
+
+    void append(uint64_t uptime_ms, uint16_t r, uint16_t g, uint16_t b) {
+        if (!_ready) {
+            return;
+        }
+
+        record_t record = { _next_sequence, _time_base + uptime_ms, r, g, b };
+        uint8_t code[5 * 4];
+        uint16_t len = encode(record, code);
+        if (_open_count > 0 && (_open_len + len > BLOCK_SIZE || record.sequence != _open_last.sequence + 1)) {
+            if (_full_waiting) {
+                _next_sequence++;
+                _stats.dropped++;
+                return;
+            }
+            seal();
+        }
+        if (_open_count == 0) {
+            openBlock(record);
+            len = encode(record, code);
+        }
+
+        memcpy(&_open[_open_len], code, len);
+        _open_len += len;
+        _open_count++;
+        _open_last = record;
+        _open_step = record.time_ms - _open_prev_time;
+        _open_prev_time = record.time_ms;
+        _next_sequence++;
+        _stats.samples++;
+
+        block_header_t header;
+        memcpy(&header, _open, BLOCK_HEADER_SIZE);
+        header.count = _open_count;
+        header.length = _open_len - BLOCK_HEADER_SIZE;
+        memcpy(_open, &header, BLOCK_HEADER_SIZE);
+    }
+
+    /* seal the open block as it is, so what it holds goes to flash now rather than when it fills; if a full
+     * block is still waiting, step() seals it right after placing that one */
+    void flush() {
+        if (_ready && _open_count > 0) {
+            if (_full_waiting) {
+                _flush_pending = true;
+            } else {
+                seal();
+            }
+        }
+    }
+
+    /* number the next sample `sequence` if that is past end(); append() starts a new block for it */
+    void skip(uint32_t sequence) {
+        if (sequence > _next_sequence) {
+            _next_sequence = sequence;
+        }
+    }
+
+    /* flash work left to do with step() */
+    bool pending() const {
+        return _sealed_done < _sealed_len || _erase_sector >= 0 || _full_waiting;
+    }
+
+    /* one bounded unit of flash work: program one chunk of the sealed block, one slice of a sector erase, or
+     * place the full block waiting behind them */
+    void step() {
+        if (_sealed_done < _sealed_len) {
+            uint32_t address = slotAddress(_sealed_sector, _sealed_slot) + _sealed_done;
+            uint16_t chunk = _sealed_len - _sealed_done < PROGRAM_CHUNK ? _sealed_len - _sealed_done : PROGRAM_CHUNK;
+            program(&_sealed[_sealed_done], address, chunk);
+            _sealed_done += chunk;
+            if (_sealed_done == _sealed_len) {
+                _stats.blocks++;
+            }
+        } else if (_erase_sector >= 0) {
+            eraseSlice(_erase_sector);
+        } else if (_full_waiting) {
+            place();
+        }
+    }
+
+    /* numbers recovery skips past the last sample found: the block being programmed, the full one and the open one */
+    static uint32_t recoveryGap() {
+        return 3 * MAX_BLOCK_SAMPLES;
+    }
+
+    /* sequence number the next sample will get */
+    uint32_t end() const {
+        return _next_sequence;
+    }
+
+    /* log time of a sample taken now */
+    uint64_t time(uint64_t uptime_ms) const {
+        return _time_base + uptime_ms;
+    }
+
+    /* position a cursor on the first sample at or after a sequence number or log time, false if there is none */
+    bool seek(cursor_t &cursor, uint64_t key, bool by_time) {
+        cursor.valid = false;
+        if (!_ready) {
+            return false;
+        }
+
+        /* last sector, oldest first, whose first block starts at or before key */
+        int found = -1;
+        for (uint8_t k = 0; k < _sectors; k++) {
+            uint8_t sector = (_head + 1 + k) % _sectors;
+            if (!_index[sector].has_blocks) {
+                continue;
+            }
+            if (found < 0 || blockKey(_index[sector], by_time) <= key) {
+                found = sector;
+            }
+        }
+        if (found < 0) {
+            return false;
+        }
+
+        /* last block of that sector starting at or before key */
+        uint16_t lo = 1;
+        uint16_t hi = usedSlots(found);
+        while (hi - lo > 1) {
+            uint16_t mid = (lo + hi) / 2;
+            block_header_t header;
+            readHeader(found, mid, header);
+            if (isErased(&header, BLOCK_HEADER_SIZE) || headerKey(header, by_time) > key) {
+                hi = mid;
+            } else {
+                lo = mid;
+            }
+        }
+
+        cursor.sector = found;
+        cursor.slot = lo;
+        if (!load(cursor)) {
+            next(cursor);
+        }
+
+        /* skip the samples of the block before key */
+        record_t record;
+        while (cursor.valid) {
+            cursor_t saved = cursor;
+            if (!next(cursor, record)) {
+                return false;
+            }
+            if ((by_time ? record.time_ms : record.sequence) >= key) {
+                cursor = saved;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* next sample after the cursor, false at the end of the log; a cursor at the end of the block still in RAM
+     * stays valid and picks up the samples appended to it later */
+    bool next(cursor_t &cursor, record_t &record) {
+        while (cursor.valid) {
+            block_header_t header;
+            memcpy(&header, cursor.block, BLOCK_HEADER_SIZE);
+            if (cursor.index < header.count) {
+                decode(cursor, record);
+                return true;
+            }
+            if (cursor.open) {
+                /* the copy is stale once the block has grown or gone to its slot, which may be in the next sector */
+                if (isOpen(cursor.sector, cursor.slot) && (_full_waiting || _open_count == header.count)) {
+                    return false;
+                }
+                return seek(cursor, cursor.last.sequence + 1, false) && next(cursor, record);
+            }
+            next(cursor);
+        }
+        return false;
+    }
+
+    const stats_t &stats() const {
+        return _stats;
+    }
+
+private:
+    struct sector_header_t {
+        uint32_t magic;
+        uint32_t sequence;      // increases each time a sector becomes the head
+        uint32_t erase_count;
+        uint32_t reserved;
+    };
+
+    struct block_header_t {
+        uint16_t magic;
+        uint16_t crc;           // CRC-16/CCITT of the rest of the header and the coded samples
+        uint32_t first_sequence;
+        uint32_t first_time_ms[2];  // low and high 32 bits, so the header has no padding
+        uint16_t count;
+        uint16_t length;        // bytes of coded samples
+    };
+
+    static const uint16_t BLOCK_HEADER_SIZE = sizeof(block_header_t);
+    /* most samples a block holds: a coded sample takes at least a byte for each of its four varints */
+    static const uint16_t MAX_BLOCK_SAMPLES = (BLOCK_SIZE - BLOCK_HEADER_SIZE) / 4;
+
+    /* what the RAM table keeps of each sector */
+    struct sector_t {
+        bool valid;             // has a sector header
+        bool has_blocks;
+        uint16_t used;          // slots in use, sector header included, unless it is the head
+        uint32_t sequence;
+        uint32_t erase_count;
+        uint32_t first_sequence;
+        uint64_t first_time_ms;
+    };
+
+    static const uint32_t SECTOR_MAGIC = 0x324C4752;  // "RGL2", blocks with 64 bit times
+    static const uint16_t BLOCK_MAGIC = 0xB10C;
+
+    /* find the head sector and the first free slot, resume sequence numbers and log time */
+    void recover() {
+        _erase_sector = -1;
+        _erasing = false;
+        _sealed_len = _sealed_done = 0;
+        _open_count = 0;
+        _full_waiting = _flush_pending = false;
+        _next_sequence = 0;
+        _time_base = 0;
+
+        int head = -1;
+        for (uint8_t i = 0; i < _sectors; i++) {
+            loadSector(i);
+            if (_index[i].valid && (head < 0 || _index[i].sequence > _index[head].sequence)) {
+                head = i;
+            }
+        }
+
+        /* no log yet: as if the last sector were a full head, sector 0 is erased by step() like any other */
+        if (head < 0) {
+            _head = _sectors - 1;
+            _slot = _slots;
+            _index[_head].sequence = 0;
+            _erase_sector = 0;
+            return;
+        }
+
+        _head = head;
+        _slot = _index[_head].used;
+
+        record_t last;
+        if (lastRecord(last)) {
+            _next_sequence = last.sequence + 1 + recoveryGap();
+            _time_base = last.time_ms + 1;
+        }
+
+        /* a full head: the next sector is erased by step() while the open block fills in RAM */
+        if (_slot == _slots) {
+            _erase_sector = (_head + 1) % _sectors;
+        }
+    }
+
+    /* last sample of the last readable block, newest sector first */
+    bool lastRecord(record_t &record) {
+        for (uint8_t k = 0; k < _sectors; k++) {
+            uint8_t sector = (_head + _sectors - k) % _sectors;
+            for (uint16_t slot = usedSlots(sector); slot-- > 1; ) {
+                cursor_t cursor;
+                cursor.sector = sector;
+                cursor.slot = slot;
+                if (!load(cursor)) {
+                    continue;
+                }
+                block_header_t header;
+                memcpy(&header, cursor.block, BLOCK_HEADER_SIZE);
+                if (header.count == 0) {
+                    continue;
+                }
+                while (cursor.index < header.count) {
+                    decode(cursor, record);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void loadSector(uint8_t sector) {
+        sector_t &entry = _index[sector];
+        sector_header_t header;
+        read(&header, sectorAddress(sector), sizeof(header));
+        entry.valid = header.magic == SECTOR_MAGIC;
+        entry.sequence = entry.valid ? header.sequence : 0;
+        entry.erase_count = entry.valid ? header.erase_count : 0;
+        entry.has_blocks = false;
+        entry.used = 0;
+        if (!entry.valid) {
+            return;
+        }
+
+        block_header_t first;
+        read(&first, slotAddress(sector, 1), sizeof(first));
+        if (first.magic == BLOCK_MAGIC) {
+            entry.has_blocks = true;
+            entry.first_sequence = first.first_sequence;
+            entry.first_time_ms = headerTime(first);
+        }
+
+        /* slots in use, the sector header included: binary search for the first erased one */
+        uint16_t lo = 1;
+        uint16_t hi = _slots;
+        while (lo < hi) {
+            uint16_t mid = (lo + hi) / 2;
+            block_header_t header;
+            read(&header, slotAddress(sector, mid), sizeof(header));
+            if (isErased(&header, sizeof(header))) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        entry.used = lo;
+    }
+
+    /* slots taken in a sector, sector header and the block at _slot included; that block of a full head is one past its end */
+    uint16_t usedSlots(uint8_t sector) const {
+        if (sector == _head && _ready) {
+            return _slot + (_full_waiting || _open_count > 0 ? 1 : 0);
+        }
+        return _index[sector].used;
+    }
+
+    /* write the header of a freshly erased sector and make it the head */
+    void openSector(uint8_t sector, uint32_t sequence) {
+        sector_header_t header = { SECTOR_MAGIC, sequence, _index[sector].erase_count, 0xFFFFFFFF };
+        uint8_t buffer[HEADER_SIZE];
+        memcpy(buffer, &header, sizeof(header));
+        program(buffer, sectorAddress(sector), HEADER_SIZE);
+
+        if (_ready && _index[_head].valid) {
+            _index[_head].used = _slots;
+        }
+        _index[sector].valid = true;
+        _index[sector].has_blocks = false;
+        _index[sector].used = 1;
+        _index[sector].sequence = sequence;
+        _head = sector;
+        _slot = 1;
+    }
+
+    /* the sector leaves the RAM table before the first slice, a partly erased one holds nothing to read */
+    void eraseSlice(uint8_t sector) {
+        if (!_erasing) {
+            _index[sector].erase_count = _index[sector].valid ? _index[sector].erase_count + 1 : 1;
+            _index[sector].valid = false;
+            _index[sector].has_blocks = false;
+            _index[sector].used = 0;
+            _erasing = true;
+        }
+        if (_flash.erase_slice(sectorAddress(sector), _sector_size)) {
+            _stats.erases++;
+            _erasing = false;
+            _erase_sector = -1;
+        }
+    }
+
+    void openBlock(const record_t &first) {
+        block_header_t header = {
+            BLOCK_MAGIC, 0, first.sequence, { (uint32_t) first.time_ms, (uint32_t) (first.time_ms >> 32) }, 0, 0
+        };
+        memcpy(_open, &header, BLOCK_HEADER_SIZE);
+        _open_len = BLOCK_HEADER_SIZE;
+        _open_prev_time = first.time_ms;
+        _open_step = 0;
+        memset(&_open_last, 0, sizeof(_open_last));
+        _open_last.time_ms = first.time_ms;
+
+        if (_slot == 1 && !_full_waiting) {
+            _index[_head].has_blocks = true;
+            _index[_head].first_sequence = first.sequence;
+            _index[_head].first_time_ms = first.time_ms;
+        }
+    }
+
+    /* hand the open block over to step(), which places it once the block and the erase ahead of it are done */
+    void seal() {
+        memcpy(_full, _open, _open_len);
+        _full_len = _open_len;
+        _full_waiting = true;
+        _open_count = 0;
+    }
+
+    /* give the full block its slot, opening the next sector if the head is full, and start programming it */
+    void place() {
+        if (_slot == _slots) {
+            openSector((_head + 1) % _sectors, _index[_head].sequence + 1);
+        }
+
+        block_header_t header;
+        memcpy(&header, _full, BLOCK_HEADER_SIZE);
+        header.crc = crc16(&_full[4], _full_len - 4);
+        memcpy(_full, &header, BLOCK_HEADER_SIZE);
+        if (_slot == 1) {
+            _index[_head].has_blocks = true;
+            _index[_head].first_sequence = header.first_sequence;
+            _index[_head].first_time_ms = headerTime(header);
+        }
+
+        _sealed_len = (_full_len + PROGRAM_CHUNK - 1) / PROGRAM_CHUNK * PROGRAM_CHUNK;
+        if (_sealed_len > BLOCK_SIZE) {
+            _sealed_len = BLOCK_SIZE;
+        }
+        memcpy(_sealed, _full, _full_len);
+        memset(&_sealed[_full_len], _erase_value, _sealed_len - _full_len);
+        _sealed_done = 0;
+        _sealed_sector = _head;
+        _sealed_slot = _slot;
+        _full_waiting = false;
+
+        /* only now is the oldest sector needed */
+        if (++_slot == _slots) {
+            _erase_sector = (_head + 1) % _sectors;
+        }
+
+        if (_flush_pending) {
+            _flush_pending = false;
+            if (_open_count > 0) {
+                seal();
+            }
+        }
+    }
+
+    /* zigzag varint deltas from the previous sample of the open block */
+    uint16_t encode(const record_t &record, uint8_t *code) const {
+        uint8_t *p = code;
+        int32_t step = _open_count > 0 ? (int32_t) (record.time_ms - _open_prev_time) : 0;
+        p = putVarint(p, zigzag(step - _open_step));
+        p = putVarint(p, zigzag((int32_t) record.r - _open_last.r));
+        p = putVarint(p, zigzag((int32_t) record.g - _open_last.g));
+        p = putVarint(p, zigzag((int32_t) record.b - _open_last.b));
+        return p - code;
+    }
+
+    void decode(cursor_t &cursor, record_t &record) {
+        const uint8_t *p = &cursor.block[cursor.offset];
+        int32_t step = cursor.last_step + unzigzag(getVarint(p));
+        record.time_ms = cursor.last.time_ms + step;
+        record.r = cursor.last.r + unzigzag(getVarint(p));
+        record.g = cursor.last.g + unzigzag(getVarint(p));
+        record.b = cursor.last.b + unzigzag(getVarint(p));
+        record.sequence = cursor.last.sequence + (cursor.index > 0 ? 1 : 0);
+
+        cursor.offset = p - cursor.block;
+        cursor.index++;
+        cursor.last = record;
+        cursor.last_step = step;
+    }
+
+    /* read the block under the cursor and reset its decoder, false if it is unreadable */
+    bool load(cursor_t &cursor) {
+        readBlock(cursor.sector, cursor.slot, cursor.block);
+        block_header_t header;
+        memcpy(&header, cursor.block, BLOCK_HEADER_SIZE);
+        cursor.valid = true;
+        cursor.open = isOpen(cursor.sector, cursor.slot);
+        if (header.magic != BLOCK_MAGIC || header.length > BLOCK_SIZE - BLOCK_HEADER_SIZE ||
+            (!isOpen(cursor.sector, cursor.slot) &&
+             header.crc != crc16(&cursor.block[4], BLOCK_HEADER_SIZE - 4 + header.length))) {
+            /* leave it to next() to move on */
+            header.count = 0;
+            memcpy(cursor.block, &header, BLOCK_HEADER_SIZE);
+            return false;
+        }
+
+        cursor.offset = BLOCK_HEADER_SIZE;
+        cursor.index = 0;
+        memset(&cursor.last, 0, sizeof(cursor.last));
+        cursor.last.sequence = header.first_sequence;
+        cursor.last.time_ms = headerTime(header);
+        cursor.last_step = 0;
+        return true;
+    }
+
+    /* move the cursor to the following block, oldest sector first, invalid past the open block */
+    void next(cursor_t &cursor) {
+        do {
+            if (++cursor.slot >= usedSlots(cursor.sector)) {
+                do {
+                    if (cursor.sector == _head) {
+                        cursor.valid = false;
+                        return;
+                    }
+                    cursor.sector = (cursor.sector + 1) % _sectors;
+                    cursor.slot = 1;
+                } while (usedSlots(cursor.sector) <= 1);
+            }
+        } while (!load(cursor));
+    }
+
+    /* the block at _slot is still in RAM: the full one waiting for place() if any, the open one otherwise; an open
+     * block behind a waiting one is left out of reads until that one has its slot */
+    bool isOpen(uint8_t sector, uint16_t slot) const {
+        return (_full_waiting || _open_count > 0) && sector == _head && slot == _slot;
+    }
+
+    const uint8_t *openBuffer() const {
+        return _full_waiting ? _full : _open;
+    }
+
+    bool isSealed(uint8_t sector, uint16_t slot) const {
+        return _sealed_done < _sealed_len && sector == _sealed_sector && slot == _sealed_slot;
+    }
+
+    /* blocks still in RAM are read from there */
+    void readBlock(uint8_t sector, uint16_t slot, uint8_t *block) {
+        if (isOpen(sector, slot)) {
+            memcpy(block, openBuffer(), _full_waiting ? _full_len : _open_len);
+        } else if (isSealed(sector, slot)) {
+            memcpy(block, _sealed, _sealed_len);
+        } else {
+            read(block, slotAddress(sector, slot), BLOCK_SIZE);
+        }
+    }
+
+    void readHeader(uint8_t sector, uint16_t slot, block_header_t &header) {
+        if (isOpen(sector, slot)) {
+            memcpy(&header, openBuffer(), BLOCK_HEADER_SIZE);
+        } else if (isSealed(sector, slot)) {
+            memcpy(&header, _sealed, BLOCK_HEADER_SIZE);
+        } else {
+            read(&header, slotAddress(sector, slot), BLOCK_HEADER_SIZE);
+        }
+    }
+
+    static uint64_t headerTime(const block_header_t &header) {
+        return header.first_time_ms[0] | (uint64_t) header.first_time_ms[1] << 32;
+    }
+
+    static uint64_t headerKey(const block_header_t &header, bool by_time) {
+        return by_time ? headerTime(header) : header.first_sequence;
+    }
+
+    static uint64_t blockKey(const sector_t &sector, bool by_time) {
+        return by_time ? sector.first_time_ms : sector.first_sequence;
+    }
+
+    void read(void *buffer, uint32_t address, uint32_t size) {
+        _flash.read(buffer, address, size);
+        _stats.reads++;
+    }
+
+    void program(const void *buffer, uint32_t address, uint32_t size) {
+        _flash.program(buffer, address, size);
+        _stats.programmed_bytes += size;
+    }
+
+    bool isErased(const void *buffer, uint32_t size) const {
+        const uint8_t *p = (const uint8_t *) buffer;
+        for (uint32_t i = 0; i < size; i++) {
+            if (p[i] != _erase_value) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t sectorAddress(uint8_t sector) const {
+        return _start + (uint32_t) sector * _sector_size;
+    }
+
+    uint32_t slotAddress(uint8_t sector, uint16_t slot) const {
+        return sectorAddress(sector) + (uint32_t) slot * BLOCK_SIZE;
+    }
+
+    static uint32_t zigzag(int32_t value) {
+        return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+    }
+
+    static int32_t unzigzag(uint32_t value) {
+        return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+    }
+
+    static uint8_t *putVarint(uint8_t *p, uint32_t value) {
+        while (value >= 0x80) {
+            *p++ = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        *p++ = value;
+        return p;
+    }
+
+    static uint32_t getVarint(const uint8_t *&p) {
+        uint32_t value = 0;
+        for (uint8_t shift = 0; shift < 35; shift += 7) {
+            uint8_t byte = *p++;
+            value |= (uint32_t) (byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        return value;
+    }
+
+    static uint16_t crc16(const uint8_t *data, uint16_t len) {
+        uint16_t crc = 0xFFFF;
+        for (uint16_t i = 0; i < len; i++) {
+            crc ^= (uint16_t) data[i] << 8;
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+            }
+        }
+        return crc;
+    }
+
+    Flash &_flash;
+    bool _ready;
+    uint32_t _start;
+    uint32_t _sector_size;
+    uint32_t _page_size;
+    uint8_t _erase_value;
+    uint8_t _sectors;
+    uint16_t _slots;
+    sector_t _index[MAX_SECTORS];
+
+    uint8_t _head;
+    uint16_t _slot;             // slot the open block goes to
+    int _erase_sector;          // sector to erase ahead of the head, -1 if none
+    bool _erasing;              // its first slice is done
+    uint32_t _next_sequence;
+    uint64_t _time_base;
+
+    uint8_t _open[BLOCK_SIZE];
+    uint16_t _open_len;
+    uint16_t _open_count;
+    record_t _open_last;
+    uint64_t _open_prev_time;
+    int32_t _open_step;
+
+    uint8_t _full[BLOCK_SIZE];  // full block waiting for place()
+    uint16_t _full_len;
+    bool _full_waiting;
+    bool _flush_pending;        // seal the open block once the full one is placed
+
+    uint8_t _sealed[BLOCK_SIZE];
+    uint16_t _sealed_len;
+    uint16_t _sealed_done;
+    uint8_t _sealed_sector;
+    uint16_t _sealed_slot;
+
+    stats_t _stats;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef FLICKER_ANALYZER_H
+#define FLICKER_ANALYZER_H
+
+#include <mbed.h>
+#include <math.h>
+
+/**
+ * Dominant flicker frequency, percent flicker and flicker index of one
+ * channel, from SAMPLES consecutive conversions of the sensor.
+ *
+ * The sensor integrates over the whole conversion period T, so what it
+ * samples is the light averaged over T: a component at f is scaled by
+ * |sinc(f T)| and folded to below fs / 2. The dominant component is found
+ * in a Hann windowed spectrum, with a Goertzel filter per bin, one bin
+ * per step() so a slow core can keep serving BLE events in between. This
+ * is the only path on every target: an FFT would need CMSIS-DSP, which
+ * the build does not carry, and would compute all the bins in one go. A
+ * peak that folds back onto a harmonic of twice the mains frequency is
+ * taken to be that harmonic. Percent flicker and flicker index come from
+ * the samples themselves, which cover every phase of a waveform not
+ * locked to fs, with the swing around the mean scaled back up by the
+ * integration loss at the dominant frequency.
+ */
+class FlickerAnalyzer {
+public:
+    static const uint16_t SAMPLES = MBED_CONF_APP_FLICKER_SAMPLES;
+
+    struct result_t {
+        uint16_t mean;          // counts
+        uint16_t apparent_dhz;  // dominant frequency as sampled, 0.1 Hz, 0 if there is none
+        uint16_t frequency_dhz; // dominant frequency once unfolded, 0.1 Hz
+        uint16_t percent;       // percent flicker, 0.01 %
+        uint16_t index;         // flicker index, 1 / 10000
+        bool detected;          // a component stands out of the noise
+        bool unfolded;          // the component was aliased from above fs / 2
+    };
+
+    FlickerAnalyzer() {
+        restart();
+    }
+
+    /* drop the samples collected so far */
+    void restart() {
+        _count = 0;
+        _bin = SAMPLES / 2;
+    }
+
+    /* add a sample, true once SAMPLES are held */
+    bool add(uint16_t value) {
+        if (_count < SAMPLES) {
+            _x[_count++] = value;
+        }
+        return _count == SAMPLES;
+    }
+
+    uint16_t count() const {
+        return _count;
+    }
+
+    /* start analysing the samples, taken period_us apart */
+    void begin(float period_us) {
+        _period_us = period_us;
+
+        uint32_t sum = 0;
+        _min = 0xFFFF;
+        _max = 0;
+        for (uint16_t i = 0; i < SAMPLES; i++) {
+            uint16_t value = _x[i];
+            sum += value;
+            if (value < _min) _min = value;
+            if (value > _max) _max = value;
+        }
+        _result.mean = (sum + SAMPLES / 2) / SAMPLES;
+        _above = 0;
+        for (uint16_t i = 0; i < SAMPLES; i++) {
+            if (_x[i] > _result.mean) _above += _x[i] - _result.mean;
+        }
+
+        /* centred and windowed in place, samples are 12 bit so they fit */
+        for (uint16_t i = 0; i < SAMPLES; i++) {
+            float window = 0.5f - 0.5f * cosf(2.0f * (float) M_PI * i / SAMPLES);
+            _x[i] = (int16_t) lrintf(((int32_t) _x[i] - _result.mean) * window);
+        }
+        _power[0] = 0;
+        _power[1] = 0;
+        _bin = 2;
+    }
+
+    /* analyse the next bin, true once the result is ready */
+    bool step() {
+        if (_bin < SAMPLES / 2) {
+            _power[_bin] = goertzel(_bin);
+            _bin++;
+            if (_bin < SAMPLES / 2) {
+                return false;
+            }
+        }
+        finish();
+        return true;
+    }
+
+    const result_t &result() const {
+        return _result;
+    }
+
+private:
+    /* weakest component reported, amplitude in counts before the integration loss is undone */
+    static const uint8_t MIN_AMPLITUDE = 2;
+    /* integration loss undone at most, near multiples of fs the component is all but gone */
+    static const uint8_t MAX_GAIN = 4;
+
+    /* power of bin k, Q14 coefficient with 64 bit products so the resonator cannot overflow */
+    float goertzel(uint16_t k) const {
+        int32_t coeff = lrintf(2.0f * cosf(2.0f * (float) M_PI * k / SAMPLES) * (1 << 14));
+        int32_t s1 = 0;
+        int32_t s2 = 0;
+        for (uint16_t i = 0; i < SAMPLES; i++) {
+            int32_t s = _x[i] + (int32_t) (((int64_t) coeff * s1) >> 14) - s2;
+            s2 = s1;
+            s1 = s;
+        }
+        int64_t power = (int64_t) s1 * s1 + (int64_t) s2 * s2 - (((int64_t) coeff * s1) >> 14) * s2;
+        return power > 0 ? (float) power : 0;
+    }
+
+    void finish() {
+        uint16_t peak = 0;
+        for (uint16_t k = 2; k < SAMPLES / 2; k++) {
+            if (peak == 0 || _power[k] > _power[peak]) peak = k;
+        }
+
+        /* the Hann window halves the amplitude, a sine of amplitude A gives |X| = A N / 4 */
+        float fs = 1e6f / _period_us;
+        float amplitude = 4.0f * sqrtf(_power[peak]) / SAMPLES;
+        _result.detected = peak != 0 && amplitude >= MIN_AMPLITUDE;
+        _result.unfolded = false;
+
+        float gain = 1.0f;
+        float apparent = 0;
+        float frequency = 0;
+        if (_result.detected) {
+            float offset = 0;
+            if (peak + 1 < SAMPLES / 2) {
+                float a = sqrtf(_power[peak - 1]), b = sqrtf(_power[peak]), c = sqrtf(_power[peak + 1]);
+                float denominator = a - 2.0f * b + c;
+                offset = denominator != 0 ? 0.5f * (a - c) / denominator : 0;
+            }
+            apparent = (peak + offset) * fs / SAMPLES;
+            frequency = unfold(apparent, fs);
+            _result.unfolded = frequency != apparent;
+
+            float x = (float) M_PI * frequency * _period_us * 1e-6f;
+            float response = fabsf(sinf(x) / x);
+            gain = response * MAX_GAIN < 1.0f ? MAX_GAIN : 1.0f / response;
+        }
+        _result.apparent_dhz = saturate(apparent * 10.0f);
+        _result.frequency_dhz = saturate(frequency * 10.0f);
+
+        float mean = _result.mean;
+        float high = mean + gain * (_max - mean);
+        float low = mean - gain * (mean - _min);
+        if (low < 0) low = 0;
+        _result.percent = high + low > 0 ? saturate(10000.0f * (high - low) / (high + low)) : 0;
+        float index = mean > 0 ? gain * _above / (mean * SAMPLES) : 0;
+        _result.index = saturate(10000.0f * (index > 1.0f ? 1.0f : index));
+    }
+
+    /* the harmonic of twice the mains frequency that folds onto `apparent`, or `apparent` itself */
+    static float unfold(float apparent, float fs) {
+        for (uint8_t n = 1; n <= 3; n++) {
+            float line = 2.0f * MBED_CONF_APP_FLICKER_MAINS_HZ * n;
+            float k = roundf(line / fs);
+            const float candidates[2] = { k * fs - apparent, k * fs + apparent };
+            for (uint8_t i = 0; i < 2; i++) {
+                /* mains frequency within 2 % and the sensor clock */
+                if (fabsf(candidates[i] - line) <= 0.02f * line) {
+                    return candidates[i];
+                }
+            }
+        }
+        return apparent;
+    }
+
+    static uint16_t saturate(float value) {
+        return value >= 65535.0f ? 0xFFFF : value <= 0 ? 0 : (uint16_t) lrintf(value);
+    }
+
+    int16_t _x[SAMPLES];        // raw samples, then centred and windowed by begin()
+    float _power[SAMPLES / 2];
+    uint16_t _count;
+    uint16_t _bin;              // next bin step() works on
+    float _period_us;
+    uint16_t _min;
+    uint16_t _max;
+    uint32_t _above;            // area above the mean, counts
+    result_t _result;
+};
+
+static_assert((MBED_CONF_APP_FLICKER_SAMPLES & (MBED_CONF_APP_FLICKER_SAMPLES - 1)) == 0 && MBED_CONF_APP_FLICKER_SAMPLES >= 32,
+              "flicker samples must be a power of two of at least 32");
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef FLICKER_METER_H
+#define FLICKER_METER_H
+
+#include <mbed.h>
+#include <events/mbed_events.h>
+#include "ISL29125.h"
+#include "RGBService.h"
+#include "FlickerAnalyzer.h"
+
+/* a gap between conversions longer than this means one was missed */
+#define FLICKER_GAP_US 9375
+#define FLICKER_MAX_RESTARTS 4
+
+/**
+ * Flicker measurement on the flicker characteristic: FlickerAnalyzer::SAMPLES
+ * conversions of one channel in a row, taken by the application at the
+ * sensor's fastest rate, then analysed one bin per event so BLE events get
+ * served in between. The result is the value clients read, and onResult()
+ * is called back for the application to notify it.
+ *
+ * The analysis needs evenly spaced samples: a conversion missed because the
+ * event queue was busy starts the run over, up to FLICKER_MAX_RESTARTS
+ * times.
+ */
+class FlickerMeter {
+public:
+    FlickerMeter(RGBService &service, events::EventQueue &event_queue) :
+        _service(service),
+        _event_queue(event_queue),
+        _busy(false),
+        _channel(0),
+        _restarts(0),
+        _first_us(0),
+        _last_us(0),
+        _time(0),
+        _period_us(0)
+    {
+        memset(_value, 0, sizeof(_value));
+    }
+
+    /* called each time a measurement has its result */
+    void onResult(mbed::Callback<void()> callback) {
+        _on_result = callback;
+    }
+
+    /* sampling or analysing */
+    bool busy() const {
+        return _busy;
+    }
+
+    /* start a measurement of channel 0: R, 1: G or 2: B, false if there is no such channel or one is running;
+     * the caller then converts sensorChannel() at the fastest rate and hands each conversion to add() */
+    bool start(uint8_t channel) {
+        if (channel > 2 || _busy) {
+            return false;
+        }
+        _analyzer.restart();
+        _busy = true;
+        _channel = channel;
+        _restarts = 0;
+        return true;
+    }
+
+    /* ISL29125 mode of the channel being measured */
+    uint8_t sensorChannel() const {
+        static const uint8_t channels[3] = { ISL29125_R, ISL29125_G, ISL29125_B };
+        return channels[_channel];
+    }
+
+    /* a conversion taken at `now_us`, `time_ms` in log time; true once the run needs no more of them, the
+     * caller then stops fast sampling */
+    bool add(uint16_t value, uint32_t now_us, uint32_t time_ms) {
+        if (_analyzer.count() > 0 && now_us - _last_us > FLICKER_GAP_US) {
+            if (++_restarts > FLICKER_MAX_RESTARTS) {
+                _busy = false;
+                printf("Flicker measurement failed, conversions missed\r\n");
+                return true;
+            }
+            _analyzer.restart();
+        }
+        if (_analyzer.count() == 0) {
+            _first_us = now_us;
+        }
+        _last_us = now_us;
+        if (!_analyzer.add(value)) {
+            return false;
+        }
+        _time = time_ms;
+        _analyzer.begin((float) (now_us - _first_us) / (FlickerAnalyzer::SAMPLES - 1));
+        _period_us = (now_us - _first_us) / (FlickerAnalyzer::SAMPLES - 1);
+        scheduleStep();
+        return true;
+    }
+
+    /* send the last result to a subscriber */
+    void notify(TxScheduler &tx, uint16_t payload) {
+        _service.notifyFlicker(tx, _value, sizeof(_value));
+    }
+
+private:
+    /* a full event queue drops the analysis, which would otherwise hold off flicker and burst requests for good */
+    void scheduleStep() {
+        if (_event_queue.call(this, &FlickerMeter::step) == 0) {
+            _busy = false;
+            printf("Flicker measurement failed, event queue full\r\n");
+        }
+    }
+
+    /* one bin of the analysis per event */
+    void step() {
+        if (!_analyzer.step()) {
+            scheduleStep();
+            return;
+        }
+        _busy = false;
+
+        const FlickerAnalyzer::result_t &result = _analyzer.result();
+        _value[0] = _channel;
+        _value[1] = (result.detected ? 0x01 : 0) | (result.unfolded ? 0x02 : 0);
+        const uint16_t values[6] = {
+            result.apparent_dhz, result.frequency_dhz, result.percent, result.index, _period_us, result.mean
+        };
+        for (uint8_t i = 0; i < 6; i++) {
+            _value[2 + 2 * i] = values[i] & 0xFF;
+            _value[3 + 2 * i] = values[i] >> 8;
+        }
+        put32(&_value[14], _time);
+        _service.setFlicker(_value, sizeof(_value));
+        printf("Flicker %u.%u Hz (%u.%u Hz sampled), %u.%02u %%, index %u.%04u\r\n",
+               result.frequency_dhz / 10, result.frequency_dhz % 10, result.apparent_dhz / 10, result.apparent_dhz % 10,
+               result.percent / 100, result.percent % 100, result.index / 10000, result.index % 10000);
+
+        if (_on_result) {
+            _on_result();
+        }
+    }
+
+    RGBService &_service;
+    events::EventQueue &_event_queue;
+    FlickerAnalyzer _analyzer;
+    bool _busy;                 // sampling or analysing
+    uint8_t _channel;
+    uint8_t _restarts;
+    uint32_t _first_us;
+    uint32_t _last_us;
+    uint32_t _time;             // log time of the last measurement
+    uint16_t _period_us;
+    uint8_t _value[RGBService::FLICKER_SIZE];
+    mbed::Callback<void()> _on_result;
+};
+
+#endif
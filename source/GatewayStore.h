@@ -0,0 +1,118 @@
+#ifndef GATEWAY_STORE_H
+#define GATEWAY_STORE_H
+
+#include <mbed.h>
+#include "storage.h"
+
+/* the central the node last bonded with, called back with directed advertising after a drop */
+struct GatewayRecord {
+    uint8_t address[6];
+    uint8_t address_type;   // ble::target_peer_address_type_t
+    uint16_t subscriptions; // RGBService characteristics it had notifications enabled for
+    uint32_t next;          // first history sample it has not received, kept across a reset
+};
+
+/* GatewayRecord of firmware from before the subscription mask outgrew 8 bit, told apart by its size */
+struct GatewayRecordV1 {
+    uint8_t address[6];
+    uint8_t address_type;
+    uint8_t subscriptions;
+};
+
+/* GatewayRecord of firmware that kept the gateway's place in the history in RAM only */
+struct GatewayRecordV2 {
+    uint8_t address[6];
+    uint8_t address_type;
+    uint16_t subscriptions;
+};
+
+static_assert(sizeof(GatewayRecordV1) != sizeof(GatewayRecord) && sizeof(GatewayRecordV2) != sizeof(GatewayRecord) &&
+              sizeof(GatewayRecordV1) != sizeof(GatewayRecordV2), "gateway records are told apart by their size");
+
+/**
+ * The gateway's record, in RAM and in KVStore, written through on every
+ * change. The gateway is kept under its identity address.
+ */
+class GatewayStore {
+public:
+    GatewayStore() :
+        _known(false),
+        _record()
+    {
+    }
+
+    /* the stored gateway, a record of an older layout is converted and written back with `next` as its place
+     * in the history; false if there is none */
+    bool load(uint32_t next) {
+        if (storage_load(STORAGE_KEY("gateway"), _record)) {
+            _known = true;
+            return true;
+        }
+        GatewayRecordV2 v2;
+        GatewayRecordV1 v1;
+        if (storage_load(STORAGE_KEY("gateway"), v2)) {
+            memcpy(_record.address, v2.address, sizeof(_record.address));
+            _record.address_type = v2.address_type;
+            _record.subscriptions = v2.subscriptions;
+        } else if (storage_load(STORAGE_KEY("gateway"), v1)) {
+            memcpy(_record.address, v1.address, sizeof(_record.address));
+            _record.address_type = v1.address_type;
+            _record.subscriptions = v1.subscriptions;
+        } else {
+            return false;
+        }
+        _record.next = next;
+        _known = true;
+        storage_save(STORAGE_KEY("gateway"), _record);
+        return true;
+    }
+
+    /* there is a gateway */
+    bool known() const {
+        return _known;
+    }
+
+    const GatewayRecord &record() const {
+        return _record;
+    }
+
+    /* the gateway has this identity address */
+    bool is(const uint8_t *address) const {
+        return _known && memcmp(address, _record.address, sizeof(_record.address)) == 0;
+    }
+
+    /* a new gateway, in place of the one there was */
+    void claim(const uint8_t *address, uint8_t address_type, uint16_t subscriptions, uint32_t next) {
+        memcpy(_record.address, address, sizeof(_record.address));
+        _record.address_type = address_type;
+        _record.subscriptions = subscriptions;
+        _record.next = next;
+        _known = true;
+        storage_save(STORAGE_KEY("gateway"), _record);
+    }
+
+    /* the CCCDs the gateway has enabled */
+    void subscribed(uint16_t subscriptions) {
+        if (subscriptions != _record.subscriptions) {
+            _record.subscriptions = subscriptions;
+            storage_save(STORAGE_KEY("gateway"), _record);
+        }
+    }
+
+    /* the first history sample the gateway has not received, once it drops */
+    void left(uint32_t next) {
+        _record.next = next;
+        storage_save(STORAGE_KEY("gateway"), _record);
+    }
+
+    void release() {
+        _known = false;
+        storage_remove(STORAGE_KEY("gateway"));
+    }
+
+private:
+    bool _known;
+    GatewayRecord _record;
+};
+
+#endif
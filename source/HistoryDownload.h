@@ -0,0 +1,195 @@
+#ifndef HISTORY_DOWNLOAD_H
+#define HISTORY_DOWNLOAD_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "SampleHistory.h"
+#include "SampleReader.h"
+
+/**
+ * The history characteristic: each subscriber follows new samples from
+ * where it is, and can ask for ranges of older ones by number or time,
+ * served in order before it goes back to following. A requested range
+ * ends with an empty frame, and during requests no more than
+ * MBED_CONF_APP_BULK_WINDOW frames go before the central acknowledges
+ * them. A frame stops at a missing sample, so the central sees gaps in the
+ * sequence numbers and can request just those. Each link keeps its own
+ * download_t.
+ */
+class HistoryDownload {
+public:
+    /* end of the range of a link following new samples */
+    static const uint32_t LIVE = 0xFFFFFFFF;
+
+    struct download_t {
+        uint32_t next;          // next history sample to send
+        uint32_t end;           // end of the range being sent, LIVE while following new samples
+        uint32_t live_next;     // where following new samples resumes once the requests are served
+        bool backlog;           // a request or more than a frame of history left to send
+
+        struct {
+            uint32_t first;
+            uint32_t end;
+        } requests[BULK_MAX_RANGES];
+        uint8_t request_count;
+        uint8_t request_index;
+        bool windowed;          // a request is being served, frames wait for ACKs
+        uint16_t frames_sent;
+        uint16_t frames_acked;
+    };
+
+    HistoryDownload(RGBService &service, const SampleHistory &history, SampleReader &reader) :
+        _service(service),
+        _history(history),
+        _reader(reader)
+    {
+    }
+
+    /* follow new samples from `next` on, any request dropped */
+    static void follow(download_t &download, uint32_t next) {
+        download.next = next;
+        download.end = LIVE;
+        download.request_count = 0;
+        download.windowed = false;
+    }
+
+    /* where following new samples resumes, the requests served or not */
+    static uint32_t resumes(const download_t &download) {
+        return download.end == LIVE ? download.next : download.live_next;
+    }
+
+    /* up to BULK_MAX_RANGES (first, count) pairs, 32 bit each; false if that is not what `len` bytes hold */
+    bool requestSequences(download_t &download, const uint8_t *p, uint16_t len) {
+        if (len == 0 || len % 8 != 0 || len / 8 > BULK_MAX_RANGES) {
+            return false;
+        }
+        uint8_t count = len / 8;
+        for (uint8_t i = 0; i < count; i++) {
+            download.requests[i].first = get32(&p[8 * i]);
+            download.requests[i].end = download.requests[i].first + get32(&p[8 * i + 4]);
+        }
+        start(download, count);
+        return true;
+    }
+
+    /* the samples from `first` to before `end` */
+    void requestRange(download_t &download, uint32_t first, uint32_t end) {
+        download.requests[0].first = first;
+        download.requests[0].end = end;
+        start(download, 1);
+    }
+
+    /* the central received `frames` history frames since its request */
+    static void ack(download_t &download, uint16_t frames) {
+        download.frames_acked = frames;
+    }
+
+    /* drop the requests, back to following new samples */
+    static void abort(download_t &download) {
+        follow(download, resumes(download));
+    }
+
+    /**
+     * Send history frames back to back while the link has TX buffers and,
+     * during a request, the window is not full. Following new samples, a
+     * partial frame waits until its oldest sample is `flush_ms` old: pump()
+     * then stops and returns how long is left, for the caller to pump again
+     * then, or at once with a `flush_ms` of 0 if it cannot wait. Otherwise
+     * it returns 0.
+     */
+    uint32_t pump(download_t &download, SampleReader::cursor_t &cursor, TxScheduler &tx, uint16_t payload,
+                  uint32_t flush_ms) {
+        uint32_t wait = 0;
+        uint16_t per_frame = (payload - RGBService::HISTORY_HEADER_SIZE) / RGBService::HISTORY_SAMPLE_SIZE;
+        uint8_t frame[RGBService::STREAM_MAX_PAYLOAD];
+        while (tx.ready()) {
+            if (download.windowed && (uint16_t) (download.frames_sent - download.frames_acked) >= MBED_CONF_APP_BULK_WINDOW) {
+                break;
+            }
+
+            bool live = download.end == LIVE;
+            uint32_t end = live ? _history.end() : download.end;
+            if (download.next >= end) {
+                if (live) {
+                    break;
+                }
+                put32(frame, end);
+                _service.updateHistory(tx, frame, RGBService::HISTORY_HEADER_SIZE);
+                download.frames_sent++;
+                nextRequest(download);
+                continue;
+            }
+            if (live && end - download.next < per_frame && download.next >= _history.begin()) {
+                uint32_t age = _reader.age(download.next);
+                if (age < flush_ms) {
+                    wait = flush_ms - age;
+                    break;
+                }
+            }
+
+            uint8_t *p = frame + RGBService::HISTORY_HEADER_SIZE;
+            uint16_t count = 0;
+            while (count < per_frame && download.next < end) {
+                SampleHistory::sample_t sample;
+                uint32_t sequence = _reader.fetch(cursor, download.next, sample);
+                if (sequence != download.next && count > 0) {
+                    break;
+                }
+                download.next = sequence;
+                if (sequence >= end) {
+                    break;
+                }
+                if (count == 0) {
+                    put32(frame, sequence);
+                }
+                put32(p, sample.time_ms);
+                p[4] = sample.r & 0xFF; p[5] = sample.r >> 8;
+                p[6] = sample.g & 0xFF; p[7] = sample.g >> 8;
+                p[8] = sample.b & 0xFF; p[9] = sample.b >> 8;
+                p += RGBService::HISTORY_SAMPLE_SIZE;
+                download.next++;
+                count++;
+            }
+
+            if (count > 0) {
+                _service.updateHistory(tx, frame, p - frame);
+                download.frames_sent++;
+            }
+        }
+        download.backlog = download.end != LIVE || _history.end() - download.next >= per_frame;
+        return wait;
+    }
+
+private:
+    /* serve `count` ranges in download.requests in order, before going back to following new samples */
+    void start(download_t &download, uint8_t count) {
+        if (download.end == LIVE) {
+            download.live_next = download.next;
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            if (download.requests[i].end > _history.end()) download.requests[i].end = _history.end();
+        }
+        download.request_count = count;
+        download.request_index = 0;
+        download.windowed = true;
+        download.frames_sent = 0;
+        download.frames_acked = 0;
+        nextRequest(download);
+    }
+
+    static void nextRequest(download_t &download) {
+        if (download.request_index < download.request_count) {
+            download.next = download.requests[download.request_index].first;
+            download.end = download.requests[download.request_index].end;
+            download.request_index++;
+        } else {
+            follow(download, download.live_next);
+        }
+    }
+
+    RGBService &_service;
+    const SampleHistory &_history;
+    SampleReader &_reader;
+};
+
+#endif
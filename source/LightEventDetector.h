@@ -0,0 +1,155 @@
+#ifndef LIGHT_EVENT_DETECTOR_H
+#define LIGHT_EVENT_DETECTOR_H
+
+#include <mbed.h>
+
+/**
+ * Turns the sample stream into the few transitions consumers care about.
+ *
+ * Intensity is the green channel, the closest to the eye's response, and
+ * colour is the blue to red ratio, which rises with colour temperature.
+ * The light is on above MBED_CONF_APP_EVENT_ON_LEVEL and off below
+ * MBED_CONF_APP_EVENT_OFF_LEVEL, the gap between them being the hysteresis.
+ * While it is on, intensity and colour each have a settled value that
+ * follows slow drift; moving away from it by more than the configured per
+ * mille is a dimming step or a colour shift.
+ *
+ * Every condition has to hold for MBED_CONF_APP_EVENT_DEBOUNCE samples in a
+ * row before its event goes out. The event then carries the time of the
+ * first of them, the settled value before and the latest value after.
+ */
+class LightEventDetector {
+public:
+    enum type_t {
+        LIGHT_ON = 1,
+        LIGHT_OFF = 2,
+        LEVEL_STEP = 3,     // intensity, green counts
+        COLOUR_SHIFT = 4    // blue / red with 8 fractional bits
+    };
+
+    struct event_t {
+        uint8_t type;
+        uint32_t time_ms;
+        uint16_t before;
+        uint16_t after;
+    };
+
+    /* most events one sample can complete */
+    static const uint8_t MAX_EVENTS = 2;
+
+    LightEventDetector() :
+        _started(false),
+        _on(false)
+    {
+    }
+
+    /* feed a sample, fills `events` and returns how many it completed */
+    uint8_t add(uint32_t time_ms, uint16_t r, uint16_t g, uint16_t b, event_t *events) {
+        uint16_t colour = ratio(b, r);
+        if (!_started) {
+            _started = true;
+            _on = g >= MBED_CONF_APP_EVENT_ON_LEVEL;
+            settle(_level, g);
+            settle(_colour, colour);
+            _switch.count = 0;
+            return 0;
+        }
+
+        uint8_t count = 0;
+        bool switching = _on ? g < MBED_CONF_APP_EVENT_OFF_LEVEL : g >= MBED_CONF_APP_EVENT_ON_LEVEL;
+        if (debounce(_switch, switching, time_ms)) {
+            _on = !_on;
+            emit(events[count++], _on ? LIGHT_ON : LIGHT_OFF, _switch.since_ms, _level.settled, g);
+            settle(_level, g);
+            settle(_colour, colour);
+            return count;
+        }
+
+        if (track(_level, g, MBED_CONF_APP_EVENT_STEP_PERMILLE, time_ms) && _on) {
+            emit(events[count++], LEVEL_STEP, _level.since_ms, _level.before, g);
+        }
+        /* colour means little in the dark */
+        if (track(_colour, colour, MBED_CONF_APP_EVENT_SHIFT_PERMILLE, time_ms) && _on) {
+            emit(events[count++], COLOUR_SHIFT, _colour.since_ms, _colour.before, colour);
+        }
+        return count;
+    }
+
+    bool on() const {
+        return _on;
+    }
+
+private:
+    struct debounce_t {
+        uint8_t count;
+        uint32_t since_ms;
+    };
+
+    struct track_t : debounce_t {
+        uint16_t settled;
+        uint16_t before;    // settled value when the move was confirmed
+        uint32_t average;   // settled value with 3 fractional bits
+    };
+
+    static uint16_t ratio(uint16_t num, uint16_t den) {
+        uint32_t value = ((uint32_t) num << 8) / (den ? den : 1);
+        return value > 0xFFFF ? 0xFFFF : value;
+    }
+
+    static void emit(event_t &event, uint8_t type, uint32_t time_ms, uint16_t before, uint16_t after) {
+        event.type = type;
+        event.time_ms = time_ms;
+        event.before = before;
+        event.after = after;
+    }
+
+    static void settle(track_t &track, uint16_t value) {
+        track.settled = value;
+        track.average = (uint32_t) value << 3;
+        track.count = 0;
+    }
+
+    /* true once `condition` has held MBED_CONF_APP_EVENT_DEBOUNCE samples in a row */
+    static bool debounce(debounce_t &state, bool condition, uint32_t time_ms) {
+        if (!condition) {
+            state.count = 0;
+            return false;
+        }
+        if (state.count++ == 0) {
+            state.since_ms = time_ms;
+        }
+        if (state.count >= MBED_CONF_APP_EVENT_DEBOUNCE) {
+            state.count = 0;
+            return true;
+        }
+        return false;
+    }
+
+    /* follow slow drift, true when the value moved away from the settled one and stayed */
+    static bool track(track_t &track, uint16_t value, uint16_t permille, uint32_t time_ms) {
+        uint32_t distance = value > track.settled ? value - track.settled : track.settled - value;
+        /* and by more than a count, so a settled value near 0 does not chatter */
+        bool moved = distance * 1000 > (uint32_t) permille * track.settled + 1000;
+        if (debounce(track, moved, time_ms)) {
+            track.before = track.settled;
+            settle(track, value);
+            return true;
+        }
+        if (!moved && track.count == 0) {
+            track.average = (int32_t) track.average + value - (int32_t) (track.average >> 3);
+            track.settled = (track.average + 4) >> 3;
+        }
+        return false;
+    }
+
+    bool _started;
+    bool _on;
+    debounce_t _switch;
+    track_t _level;
+    track_t _colour;
+};
+
+static_assert(MBED_CONF_APP_EVENT_OFF_LEVEL < MBED_CONF_APP_EVENT_ON_LEVEL, "the light must turn off below the level it turns on at");
+static_assert(MBED_CONF_APP_EVENT_DEBOUNCE > 0, "events need at least one sample");
+
+#endif
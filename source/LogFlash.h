@@ -0,0 +1,93 @@
+#ifndef LOG_FLASH_H
+#define LOG_FLASH_H
+
+#include <mbed.h>
+
+/**
+ * FlashIAP with the sliced erase FlashLog asks for: erase_slice() does one
+ * bounded part of a sector erase and is called again, an event at a time,
+ * until it reports the sector erased.
+ *
+ * An erase halts the CPU. On nRF52 parts with partial page erase a slice
+ * is an ERASEPAGEPARTIAL of flash-log-erase-slice-ms, repeated until the
+ * slices add up to the longest page erase of the product specification,
+ * so the stall per event is the slice rather than the whole erase. The
+ * first word of the page is cleared before the first slice: a reset part
+ * way through must not leave a sector header that still reads as valid.
+ * Elsewhere the sector is erased in a single slice, and the CPU stalls for
+ * the whole sector erase time of the part.
+ *
+ * A target without FlashIAP (DEVICE_FLASH) gets a LogFlash that fails to
+ * initialize, so the log stays off there.
+ */
+#if DEVICE_FLASH
+class LogFlash : public FlashIAP {
+public:
+    /* cumulative partial erase time that erases a page for sure, tERASEPAGE of the nRF52 parts */
+    static const uint32_t PAGE_ERASE_MS = 85;
+
+    LogFlash() :
+        _slice_address(0xFFFFFFFF),
+        _slice_ms(0)
+    {
+    }
+
+    /* erase part of the sector at address, true once it is all erased */
+    bool erase_slice(uint32_t address, uint32_t size) {
+#if defined(NVMC_ERASEPAGEPARTIALCFG_DURATION_Msk)
+        if (size == NRF_FICR->CODEPAGESIZE) {
+            if (address != _slice_address) {
+                _slice_address = address;
+                _slice_ms = 0;
+                nvmc(NVMC_CONFIG_WEN_Wen);
+                *(volatile uint32_t *) address = 0;
+                nvmc(NVMC_CONFIG_WEN_Ren);
+            }
+            NRF_NVMC->ERASEPAGEPARTIALCFG =
+                MBED_CONF_APP_FLASH_LOG_ERASE_SLICE_MS << NVMC_ERASEPAGEPARTIALCFG_DURATION_Pos;
+            nvmc(NVMC_CONFIG_WEN_Een);
+            NRF_NVMC->ERASEPAGEPARTIAL = address;
+            nvmc(NVMC_CONFIG_WEN_Ren);
+            _slice_ms += MBED_CONF_APP_FLASH_LOG_ERASE_SLICE_MS;
+            if (_slice_ms < PAGE_ERASE_MS) {
+                return false;
+            }
+            _slice_address = 0xFFFFFFFF;
+            return true;
+        }
+#endif
+        erase(address, size);
+        return true;
+    }
+
+private:
+#if defined(NVMC_ERASEPAGEPARTIALCFG_DURATION_Msk)
+    /* switch the NVMC mode once it is done with the previous operation, and wait for the new one */
+    static void nvmc(uint32_t mode) {
+        while (!NRF_NVMC->READY) {
+        }
+        NRF_NVMC->CONFIG = mode << NVMC_CONFIG_WEN_Pos;
+        while (!NRF_NVMC->READY) {
+        }
+    }
+#endif
+
+    uint32_t _slice_address;    // sector being erased in slices, 0xFFFFFFFF if none
+    uint32_t _slice_ms;
+};
+#else
+class LogFlash {
+public:
+    int init() { return -1; }
+    uint32_t get_flash_start() const { return 0; }
+    uint32_t get_flash_size() const { return 0; }
+    uint32_t get_sector_size(uint32_t) const { return 0; }
+    uint32_t get_page_size() const { return 0; }
+    uint8_t get_erase_value() const { return 0xFF; }
+    int read(void *, uint32_t, uint32_t) { return -1; }
+    int program(const void *, uint32_t, uint32_t) { return -1; }
+    bool erase_slice(uint32_t, uint32_t) { return true; }
+};
+#endif
+
+#endif
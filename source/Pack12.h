@@ -0,0 +1,57 @@
+#ifndef PACK12_H
+#define PACK12_H
+
+#include <stdint.h>
+
+/**
+ * 12 bit values packed two in three bytes, for samples taken at the
+ * sensor's 12 bit resolution.
+ *
+ * Each pair is a little endian 24 bit word, the first value in its low 12
+ * bits and the second in the high 12. An odd count ends with the last value
+ * alone in two bytes, little endian. Values above 12 bits are saturated.
+ *
+ * The kernels take a whole batch, so the pair loop has no per-value branch
+ * and the compiler can keep both values in registers. Only <stdint.h> is
+ * needed, so gateways and host tools can share it.
+ */
+class Pack12 {
+public:
+    static const uint16_t MAX = 0x0FFF;
+
+    /* bytes taken by `count` packed values */
+    static constexpr uint16_t size(uint16_t count) {
+        return (3 * count + 1) / 2;
+    }
+
+    /* pack `count` values to `out`, returns the bytes written */
+    static uint16_t pack(const uint16_t *values, uint16_t count, uint8_t *out) {
+        uint16_t written = size(count);
+        for (; count >= 2; count -= 2, values += 2, out += 3) {
+            uint16_t a = values[0] > MAX ? MAX : values[0];
+            uint16_t b = values[1] > MAX ? MAX : values[1];
+            out[0] = a & 0xFF;
+            out[1] = (a >> 8) | ((b & 0x0F) << 4);
+            out[2] = b >> 4;
+        }
+        if (count) {
+            uint16_t a = values[0] > MAX ? MAX : values[0];
+            out[0] = a & 0xFF;
+            out[1] = a >> 8;
+        }
+        return written;
+    }
+
+    /* unpack `count` values from `in` */
+    static void unpack(const uint8_t *in, uint16_t count, uint16_t *values) {
+        for (; count >= 2; count -= 2, values += 2, in += 3) {
+            values[0] = in[0] | ((in[1] & 0x0F) << 8);
+            values[1] = (in[1] >> 4) | (in[2] << 4);
+        }
+        if (count) {
+            values[0] = in[0] | ((in[1] & 0x0F) << 8);
+        }
+    }
+};
+
+#endif
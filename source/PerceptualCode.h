@@ -0,0 +1,102 @@
+#ifndef PERCEPTUAL_CODE_H
+#define PERCEPTUAL_CODE_H
+
+#include <stdint.h>
+
+/**
+ * 8 bit perceptual code of a 16 bit channel, for clients that only show
+ * the light and would rather have twice the samples per frame.
+ *
+ * Code i stands for the level KNEE * (ratio^i - 1), rounded, with the ratio
+ * that makes code 255 stand for 65535: logarithmic well above KNEE counts,
+ * as the eye is, and linear below it, where the first levels are the counts
+ * themselves. A value gets the code of the nearest level, so the decoded
+ * value is off by at most 2 % of the value plus KNEE counts, and by at most
+ * 1.7 % of the value from 1000 counts up. The asserts below check both
+ * bounds over every code.
+ *
+ * Levels and the thresholds between them are computed at compile time into
+ * a table in flash. Encoding is a binary search over the thresholds, eight
+ * comparisons, decoding a lookup. Only <stdint.h> is needed, so gateways and
+ * host tools can share the table.
+ */
+class PerceptualCode {
+public:
+    static const uint16_t KNEE = 16;
+
+    struct table_t {
+        uint16_t level[256];        // value each code stands for
+        uint16_t threshold[256];    // least value that gets each code
+    };
+
+    static uint8_t encode(uint16_t value) {
+        const table_t &t = table();
+        uint8_t code = 0;
+        for (uint8_t bit = 0x80; bit; bit >>= 1) {
+            if (value >= t.threshold[code | bit]) {
+                code |= bit;
+            }
+        }
+        return code;
+    }
+
+    static uint16_t decode(uint8_t code) {
+        return table().level[code];
+    }
+
+    static constexpr table_t build() {
+        /* ratio^255 = 1 + 65535 / KNEE, by bisection */
+        double low = 1.0, high = 2.0;
+        for (int i = 0; i < 50; i++) {
+            double ratio = (low + high) / 2, power = 1.0;
+            for (int n = 0; n < 255; n++) {
+                power *= ratio;
+            }
+            if (power < 1.0 + 65535.0 / KNEE) {
+                low = ratio;
+            } else {
+                high = ratio;
+            }
+        }
+
+        table_t t = {};
+        double power = 1.0;
+        for (int i = 0; i < 256; i++) {
+            uint16_t level = i == 255 ? 65535 : (uint16_t) (KNEE * (power - 1.0) + 0.5);
+            /* in the dark the curve is flatter than a count per code, those codes take the counts in turn */
+            t.level[i] = i > 0 && level <= t.level[i - 1] ? t.level[i - 1] + 1 : level;
+            t.threshold[i] = i == 0 ? 0 : (t.level[i - 1] + t.level[i] + 1) / 2;
+            power *= low;
+        }
+        return t;
+    }
+
+    /* false unless every code stands for a higher level than the one below and stays within the bounds */
+    static constexpr bool check(const table_t &t) {
+        for (int i = 0; i < 256; i++) {
+            if (i > 0 && t.level[i] <= t.level[i - 1]) {
+                return false;
+            }
+            /* the error is largest at either end of the values that get the code */
+            uint32_t ends[2] = { t.threshold[i], i < 255 ? t.threshold[i + 1] - 1u : 65535u };
+            for (int e = 0; e < 2; e++) {
+                uint32_t value = ends[e];
+                uint32_t error = value > t.level[i] ? value - t.level[i] : t.level[i] - value;
+                if (error * 1000 > 20 * (value + KNEE) || (value >= 1000 && error * 1000 > 17 * value)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    static const table_t &table() {
+        static constexpr table_t table = build();
+        return table;
+    }
+};
+
+static_assert(PerceptualCode::check(PerceptualCode::build()), "the perceptual code must stay within its documented error");
+
+#endif
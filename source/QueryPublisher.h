@@ -0,0 +1,89 @@
+#ifndef QUERY_PUBLISHER_H
+#define QUERY_PUBLISHER_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "SampleHistory.h"
+#include "SampleLog.h"
+
+/**
+ * Range queries on the query characteristic: min, max and mean between two
+ * sample numbers, from the block summaries of the RAM history, then the
+ * samples it no longer holds read back from the flash log a few at a time
+ * by the application's scan() calls. The result starts with the first
+ * sample it covers, later than asked once the log has dropped the older
+ * ones too. Each link keeps its own query_t.
+ */
+class QueryPublisher {
+public:
+    struct query_t {
+        bool busy;              // the part older than the RAM history is read from the flash log
+        uint32_t end;           // end of that part
+        uint32_t covered;       // first sample the result covers
+        bool found;             // the flash log had a sample of it
+        SampleHistory::summary_t summary;
+        SampleLog::cursor_t cursor;
+    };
+
+    QueryPublisher(RGBService &service, const SampleHistory &history, SampleLog &log) :
+        _service(service),
+        _history(history),
+        _log(log)
+    {
+    }
+
+    /* start a query of the samples from `first` to before `end`, replacing the one a link had;
+     * true while the flash log has to be scanned, otherwise the result is ready to publish */
+    bool start(query_t &query, uint32_t first, uint32_t end) {
+        _history.summarize(first, end, query.summary);
+        query.covered = first < _history.begin() ? _history.begin() : first;
+        query.end = end < _history.begin() ? end : _history.begin();
+        query.found = false;
+        query.busy = first < query.end && _log.seek(query.cursor, first, false);
+        return query.busy;
+    }
+
+    /* add up to `samples` samples of the flash log to a query, true once they ran past its end and the result is
+     * ready to publish */
+    bool scan(query_t &query, uint32_t samples) {
+        SampleLog::record_t record;
+        for (uint32_t n = 0; n < samples; n++) {
+            if (!_log.next(query.cursor, record) || record.sequence >= query.end) {
+                query.busy = false;
+                return true;
+            }
+            if (!query.found) {
+                query.covered = record.sequence;
+                query.found = true;
+            }
+            SampleHistory::sample_t sample = { (uint32_t) record.time_ms, record.r, record.g, record.b };
+            SampleHistory::add(query.summary, sample);
+        }
+        return false;
+    }
+
+    /* set the result of a query, notified to the link if it subscribed */
+    void publish(const query_t &query, TxScheduler &tx, uint16_t payload, bool subscribed) {
+        const SampleHistory::summary_t &summary = query.summary;
+        uint8_t result[RGBService::QUERY_RESULT_SIZE];
+        put32(result, query.covered);
+        uint16_t values[10] = { (uint16_t) (summary.count > 0xFFFF ? 0xFFFF : summary.count) };
+        for (uint8_t c = 0; c < 3; c++) {
+            values[1 + c] = summary.min[c];
+            values[4 + c] = summary.max[c];
+            values[7 + c] = summary.count ? (summary.sum[c] + summary.count / 2) / summary.count : 0;
+        }
+        for (uint8_t i = 0; i < 10; i++) {
+            result[4 + 2 * i] = values[i] & 0xFF;
+            result[5 + 2 * i] = values[i] >> 8;
+        }
+        _service.updateQuery(tx, payload, subscribed, result, sizeof(result));
+    }
+
+private:
+    RGBService &_service;
+    const SampleHistory &_history;
+    SampleLog &_log;
+};
+
+#endif
@@ -0,0 +1,453 @@
+#ifndef RGB_SERVICE_H
+#define RGB_SERVICE_H
+
+#include <mbed.h>
+#include "ble/BLE.h"
+#include "TxScheduler.h"
+#include "Calibration.h"
+
+// UUID per il servizio RGB
+#define UUID_RGB_SERVICE "12345678-1234-5678-1234-56789abcdef0"
+
+// UUID per le caratteristiche RGB
+#define UUID_RED_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef1"
+#define UUID_GREEN_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef2"
+#define UUID_BLUE_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef3"
+// UUID per la caratteristica di streaming (campioni RGB raggruppati)
+#define UUID_STREAM_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef4"
+// UUID per la caratteristica dello storico (campioni con numero di sequenza e tempo)
+#define UUID_HISTORY_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef5"
+// UUID per il punto di controllo dello scaricamento dello storico
+#define UUID_CONTROL_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef6"
+// UUID per la caratteristica dei riepiloghi (min, max, media per periodo)
+#define UUID_ROLLUP_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef7"
+// UUID per la caratteristica delle interrogazioni sullo storico (min, max, media tra due istanti)
+#define UUID_QUERY_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef8"
+// UUID per la caratteristica delle statistiche (media e varianza su una finestra di campioni)
+#define UUID_STATS_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef9"
+// UUID per la caratteristica di configurazione (periodo, portata, risoluzione, raggruppamento)
+#define UUID_CONFIG_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdefa"
+// UUID per la caratteristica delle acquisizioni veloci di un canale (modalita' oscilloscopio)
+#define UUID_BURST_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdefb"
+// UUID per la caratteristica dello sfarfallio (frequenza, percentuale e indice di flicker)
+#define UUID_FLICKER_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdefc"
+// UUID per la caratteristica degli eventi (accensione, spegnimento, variazioni di intensita' e colore)
+#define UUID_EVENT_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdefd"
+// UUID per la caratteristica della scena riconosciuta (classe e confidenza)
+#define UUID_SCENE_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdefe"
+// UUID per la caratteristica del modello delle scene (centroidi di cromaticita')
+#define UUID_SCENE_MODEL_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdeff"
+// UUID per la caratteristica dei valori calibrati (CIE XYZ e cromaticita' xy)
+#define UUID_XYZ_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdf00"
+// UUID per la caratteristica della calibrazione del dispositivo
+#define UUID_CALIBRATION_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdf01"
+// UUID per la caratteristica dei contatori di acquisizione e consegna
+#define UUID_COUNTERS_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdf02"
+// UUID per la caratteristica degli ACK dello stream affidabile
+#define UUID_STREAM_ACK_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdf03"
+
+/* ATT and L2CAP header sizes, used to size stream frames to the link */
+#define ATT_HEADER_SIZE 3
+#define L2CAP_HEADER_SIZE 4
+/* default ATT_MTU and link layer payload before any negotiation */
+#define DEFAULT_ATT_MTU 23
+#define DEFAULT_LL_OCTETS 27
+/* ranges a single bulk download request can ask for */
+#define BULK_MAX_RANGES 4
+
+class RGBService {
+public:
+    typedef uint16_t RGBType_t;
+
+    /* bits of subscriptions() */
+    enum {
+        RED_SUBSCRIBED = 1 << 0,
+        GREEN_SUBSCRIBED = 1 << 1,
+        BLUE_SUBSCRIBED = 1 << 2,
+        STREAM_SUBSCRIBED = 1 << 3,
+        HISTORY_SUBSCRIBED = 1 << 4,
+        ROLLUP_SUBSCRIBED = 1 << 5,
+        QUERY_SUBSCRIBED = 1 << 6,
+        STATS_SUBSCRIBED = 1 << 7,
+        BURST_SUBSCRIBED = 1 << 8,
+        FLICKER_SUBSCRIBED = 1 << 9,
+        EVENT_SUBSCRIBED = 1 << 10,
+        SCENE_SUBSCRIBED = 1 << 11,
+        XYZ_SUBSCRIBED = 1 << 12,
+        COUNTERS_SUBSCRIBED = 1 << 13
+    };
+
+    /* times in frames and requests are log time in ms, see FlashLog.h, cut to its low 32 bits: a gateway
+     * unwraps them against the newest it has, and a time it writes stands for the latest with those bits */
+    /* stream frame: acquisition sequence number of the first sample, little endian 32 bit, the layout
+     * of the samples (0: 16 bit, 1: perceptual, 2: packed 12 bit), 8 bit, then the samples, acquired
+     * one after the other; the layout follows the configuration, a frame always has a single one */
+    static const uint16_t STREAM_HEADER_SIZE = sizeof(uint32_t) + 1;
+    /* one stream sample: R, G, B as little endian 16 bit values */
+    static const uint16_t STREAM_SAMPLE_SIZE = 3 * sizeof(RGBType_t);
+    /* one stream sample with the perceptual encoding: R, G, B codes, see PerceptualCode.h */
+    static const uint16_t STREAM_PERCEPTUAL_SAMPLE_SIZE = 3;
+    /* at 12 bit resolution the 16 bit encoding packs the R, G, B values of the whole frame, two in three
+     * bytes as in Pack12.h: a pair of samples takes 9 bytes, a last odd one 5 */
+    /* largest notification payload: ATT_MTU 247 minus the ATT header */
+    static const uint16_t STREAM_MAX_PAYLOAD = TX_MAX_FRAME;
+    /* history frame: sequence number of the first sample, little endian 32 bit, then the samples */
+    static const uint16_t HISTORY_HEADER_SIZE = sizeof(uint32_t);
+    /* one history sample: time in ms, little endian 32 bit, then R, G, B like a stream sample */
+    static const uint16_t HISTORY_SAMPLE_SIZE = sizeof(uint32_t) + STREAM_SAMPLE_SIZE;
+    /* rollup frame: level, then the start in log time ms of the first period, little endian 32 bit */
+    static const uint16_t ROLLUP_HEADER_SIZE = 1 + sizeof(uint32_t);
+    /* one rollup: sample count, then min, max and mean of R, G, B, all little endian 16 bit */
+    static const uint16_t ROLLUP_SIZE = 10 * sizeof(uint16_t);
+    /* query written by a client: first and end log time in ms, little endian 32 bit */
+    static const uint16_t QUERY_REQUEST_SIZE = 2 * sizeof(uint32_t);
+    /* query result: first sequence number covered, from RAM or the flash log, 32 bit, sample count,
+     * saturated, then min, max and mean of R, G, B, 16 bit; notified in parts below an ATT_MTU of 27.
+     * A range reaching into the flash log is answered once the log has been read, some events later */
+    static const uint16_t QUERY_RESULT_SIZE = sizeof(uint32_t) + 10 * sizeof(uint16_t);
+    /* statistics: sequence number of the last sample, 32 bit, sample count, 16 bit, then for R, G, B
+     * min and max, 16 bit, mean with 8 fractional bits and sample variance, 32 bit; all little endian.
+     * Notified in parts below an ATT_MTU of 45, see notifyValue() */
+    static const uint16_t STATS_SIZE = sizeof(uint32_t) + sizeof(uint16_t) + 3 * (2 * sizeof(uint16_t) + 2 * sizeof(uint32_t));
+    /* configuration: sampling period in ms, which adaptive-rate shortens while the light changes and
+     * stretches by adaptive-steady-multiplier while it is steady, 32 bit, range (0: 375 lux,
+     * 1: 10000 lux), resolution (0: 16 bit, 1: 12 bit), the longest a sample waits in a stream frame
+     * in ms, 16 bit, then the stream encoding (0: 16 bit, packed at 12 bit resolution, 1: perceptual 8 bit) */
+    static const uint16_t CONFIG_SIZE = sizeof(uint32_t) + 2 + sizeof(uint16_t) + 1;
+    /* burst frame: index of the first sample in the capture, little endian 16 bit, then the samples,
+     * 16 bit each; the info frame uses index 0xFFFF */
+    static const uint16_t BURST_HEADER_SIZE = sizeof(uint16_t);
+    /* burst info frame: channel (0: R, 1: G, 2: B), flags, 8 bit, sample count, trigger index and
+     * mean sample period in us, 16 bit, then the log time in ms of the trigger, 32 bit */
+    static const uint16_t BURST_INFO_SIZE = BURST_HEADER_SIZE + 2 + 3 * sizeof(uint16_t) + sizeof(uint32_t);
+    /* flicker: channel (0: R, 1: G, 2: B) and flags, 8 bit, then dominant frequency as sampled and
+     * unfolded in 0.1 Hz, percent flicker in 0.01 %, flicker index in 1 / 10000, sample period in us
+     * and mean in counts, 16 bit, then the log time in ms of the measurement, 32 bit */
+    static const uint16_t FLICKER_SIZE = 2 + 6 * sizeof(uint16_t) + sizeof(uint32_t);
+    /* light event: type (LightEventDetector::type_t), 8 bit, log time in ms, 32 bit, then the value
+     * before and after, 16 bit */
+    static const uint16_t EVENT_SIZE = 1 + sizeof(uint32_t) + 2 * sizeof(uint16_t);
+    /* scene: class, 0xFF when none matches, and confidence out of 255, 8 bit each */
+    static const uint16_t SCENE_SIZE = 2;
+    /* scene model: for each centroid its r and g chromaticity, 10 fractional bits, little endian 16 bit */
+    static const uint16_t SCENE_CENTROID_SIZE = 2 * sizeof(uint16_t);
+    static const uint16_t SCENE_MODEL_MAX_SIZE = MBED_CONF_APP_SCENE_MAX * SCENE_CENTROID_SIZE;
+    /* calibrated sample: X, Y, Z in counts, then x and y chromaticity with 16 fractional bits, little endian 16 bit */
+    static const uint16_t XYZ_SIZE = 5 * sizeof(uint16_t);
+    /* calibration record, laid out in Calibration.h: too long for the default ATT_MTU, so the factory
+     * station raises it before writing; written only by the gateway over its encrypted link, like the scene model */
+    static const uint16_t CALIBRATION_SIZE = sizeof(Calibration);
+    /* counters: sequence number of the last sample, then samples acquired, sensor reads without a new
+     * sample, and for the reading central's stream samples suppressed while it caught up on the history,
+     * queued, dropped by backpressure, delivered to the stack and sent again in reliable mode; little
+     * endian 32 bit each; notified in parts below an ATT_MTU of 35 */
+    static const uint16_t COUNTERS_SIZE = 8 * sizeof(uint32_t);
+    /* stream ACK written by the gateway: sequence number of the first sample it has not received,
+     * little endian 32 bit */
+    static const uint16_t STREAM_ACK_SIZE = sizeof(uint32_t);
+    /* longest control point command: opcode and BULK_MAX_RANGES (first, count) pairs */
+    static const uint16_t CONTROL_MAX_SIZE = 1 + BULK_MAX_RANGES * 2 * sizeof(uint32_t);
+
+    RGBService(BLE& _ble) :
+        ble(_ble),
+        redCharacteristic(UUID_RED_CHARACTERISTIC, &red, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        greenCharacteristic(UUID_GREEN_CHARACTERISTIC, &green, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        blueCharacteristic(UUID_BLUE_CHARACTERISTIC, &blue, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        streamCharacteristic(UUID_STREAM_CHARACTERISTIC, stream, 0, STREAM_MAX_PAYLOAD, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        historyCharacteristic(UUID_HISTORY_CHARACTERISTIC, history, 0, STREAM_MAX_PAYLOAD, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        controlCharacteristic(UUID_CONTROL_CHARACTERISTIC, control, 0, CONTROL_MAX_SIZE,
+                              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE),
+        rollupCharacteristic(UUID_ROLLUP_CHARACTERISTIC, rollup, 0, STREAM_MAX_PAYLOAD, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        queryCharacteristic(UUID_QUERY_CHARACTERISTIC, query, 0, QUERY_RESULT_SIZE,
+                            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+                            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        statsCharacteristic(UUID_STATS_CHARACTERISTIC, stats, 0, STATS_SIZE,
+                            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        configCharacteristic(UUID_CONFIG_CHARACTERISTIC, config, CONFIG_SIZE, CONFIG_SIZE,
+                             GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
+                             NULL, 0, /* variable length */ false),
+        burstCharacteristic(UUID_BURST_CHARACTERISTIC, burst, 0, STREAM_MAX_PAYLOAD, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        flickerCharacteristic(UUID_FLICKER_CHARACTERISTIC, flicker, 0, FLICKER_SIZE,
+                              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        eventCharacteristic(UUID_EVENT_CHARACTERISTIC, event, 0, EVENT_SIZE,
+                            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        sceneCharacteristic(UUID_SCENE_CHARACTERISTIC, scene, 0, SCENE_SIZE,
+                            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        sceneModelCharacteristic(UUID_SCENE_MODEL_CHARACTERISTIC, sceneModel, 0, SCENE_MODEL_MAX_SIZE,
+                                 GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE),
+        xyzCharacteristic(UUID_XYZ_CHARACTERISTIC, xyz, 0, XYZ_SIZE,
+                          GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        calibrationCharacteristic(UUID_CALIBRATION_CHARACTERISTIC, calibration, CALIBRATION_SIZE, CALIBRATION_SIZE,
+                                  GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
+                                  NULL, 0, /* variable length */ false),
+        countersCharacteristic(UUID_COUNTERS_CHARACTERISTIC, counters, 0, COUNTERS_SIZE,
+                               GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        streamAckCharacteristic(UUID_STREAM_ACK_CHARACTERISTIC, streamAck, STREAM_ACK_SIZE, STREAM_ACK_SIZE,
+                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE,
+                                NULL, 0, /* variable length */ false)
+    {
+        GattCharacteristic *charTable[] = {
+            &redCharacteristic, &greenCharacteristic, &blueCharacteristic, &streamCharacteristic, &historyCharacteristic,
+            &controlCharacteristic, &rollupCharacteristic, &queryCharacteristic, &statsCharacteristic, &configCharacteristic,
+            &burstCharacteristic, &flickerCharacteristic, &eventCharacteristic, &sceneCharacteristic, &sceneModelCharacteristic,
+            &xyzCharacteristic, &calibrationCharacteristic, &countersCharacteristic, &streamAckCharacteristic
+        };
+        GattService rgbService(UUID_RGB_SERVICE, charTable, sizeof(charTable) / sizeof(GattCharacteristic *));
+        ble.gattServer().addService(rgbService);
+    }
+
+    /* characteristics the central on this connection has enabled notifications for */
+    uint16_t subscriptions(ble::connection_handle_t connection) {
+        uint16_t mask = 0;
+        if (isSubscribed(connection, redCharacteristic)) mask |= RED_SUBSCRIBED;
+        if (isSubscribed(connection, greenCharacteristic)) mask |= GREEN_SUBSCRIBED;
+        if (isSubscribed(connection, blueCharacteristic)) mask |= BLUE_SUBSCRIBED;
+        if (isSubscribed(connection, streamCharacteristic)) mask |= STREAM_SUBSCRIBED;
+        if (isSubscribed(connection, historyCharacteristic)) mask |= HISTORY_SUBSCRIBED;
+        if (isSubscribed(connection, rollupCharacteristic)) mask |= ROLLUP_SUBSCRIBED;
+        if (isSubscribed(connection, queryCharacteristic)) mask |= QUERY_SUBSCRIBED;
+        if (isSubscribed(connection, statsCharacteristic)) mask |= STATS_SUBSCRIBED;
+        if (isSubscribed(connection, burstCharacteristic)) mask |= BURST_SUBSCRIBED;
+        if (isSubscribed(connection, flickerCharacteristic)) mask |= FLICKER_SUBSCRIBED;
+        if (isSubscribed(connection, eventCharacteristic)) mask |= EVENT_SUBSCRIBED;
+        if (isSubscribed(connection, sceneCharacteristic)) mask |= SCENE_SUBSCRIBED;
+        if (isSubscribed(connection, xyzCharacteristic)) mask |= XYZ_SUBSCRIBED;
+        if (isSubscribed(connection, countersCharacteristic)) mask |= COUNTERS_SUBSCRIBED;
+        return mask;
+    }
+
+    void updateRed(TxScheduler &tx, RGBType_t newRedVal) {
+        red = newRedVal;
+        tx.send(redCharacteristic.getValueHandle(), (uint8_t *) &red, sizeof(RGBType_t), TxScheduler::COALESCE);
+    }
+
+    void updateGreen(TxScheduler &tx, RGBType_t newGreenVal) {
+        green = newGreenVal;
+        tx.send(greenCharacteristic.getValueHandle(), (uint8_t *) &green, sizeof(RGBType_t), TxScheduler::COALESCE);
+    }
+
+    void updateBlue(TxScheduler &tx, RGBType_t newBlueVal) {
+        blue = newBlueVal;
+        tx.send(blueCharacteristic.getValueHandle(), (uint8_t *) &blue, sizeof(RGBType_t), TxScheduler::COALESCE);
+    }
+
+    /* send a batch of `samples` packed as consecutive records of the configured encoding */
+    void updateStream(TxScheduler &tx, const uint8_t *frame, uint16_t len, uint16_t samples) {
+        tx.send(streamCharacteristic.getValueHandle(), frame, len, TxScheduler::DROP_OLDEST, samples);
+    }
+
+    /* send a frame of history samples, only when tx.ready() so none is ever dropped */
+    void updateHistory(TxScheduler &tx, const uint8_t *frame, uint16_t len) {
+        tx.send(historyCharacteristic.getValueHandle(), frame, len, TxScheduler::DROP_OLDEST);
+    }
+
+    /* send a frame of rollups, only when tx.ready() */
+    void updateRollup(TxScheduler &tx, const uint8_t *frame, uint16_t len) {
+        tx.send(rollupCharacteristic.getValueHandle(), frame, len, TxScheduler::DROP_OLDEST);
+    }
+
+    /* send a frame of a burst capture, only when tx.ready() */
+    void updateBurst(TxScheduler &tx, const uint8_t *frame, uint16_t len) {
+        tx.send(burstCharacteristic.getValueHandle(), frame, len, TxScheduler::DROP_OLDEST);
+    }
+
+    /* make a query result the value read by clients and notify it to this one if it subscribed */
+    void updateQuery(TxScheduler &tx, uint16_t payload, bool notify, const uint8_t *result, uint16_t len) {
+        ble.gattServer().write(queryCharacteristic.getValueHandle(), result, len, /* local only */ true);
+        if (notify) {
+            notifyValue(tx, payload, queryCharacteristic.getValueHandle(), result, len);
+        }
+    }
+
+    /* make a central's counters the value read by clients and notify them to it if it subscribed */
+    void updateCounters(TxScheduler &tx, uint16_t payload, bool notify, const uint8_t *value) {
+        ble.gattServer().write(countersCharacteristic.getValueHandle(), value, COUNTERS_SIZE, /* local only */ true);
+        if (notify) {
+            notifyValue(tx, payload, countersCharacteristic.getValueHandle(), value, COUNTERS_SIZE);
+        }
+    }
+
+    /* make new statistics the value read by clients, notifying is up to the caller */
+    void setStats(const uint8_t *value, uint16_t len) {
+        ble.gattServer().write(statsCharacteristic.getValueHandle(), value, len, /* local only */ true);
+    }
+
+    void notifyStats(TxScheduler &tx, uint16_t payload, const uint8_t *value, uint16_t len) {
+        notifyValue(tx, payload, statsCharacteristic.getValueHandle(), value, len);
+    }
+
+    /* make a flicker measurement the value read by clients, notifying is up to the caller */
+    void setFlicker(const uint8_t *value, uint16_t len) {
+        ble.gattServer().write(flickerCharacteristic.getValueHandle(), value, len, /* local only */ true);
+    }
+
+    void notifyFlicker(TxScheduler &tx, const uint8_t *value, uint16_t len) {
+        tx.send(flickerCharacteristic.getValueHandle(), value, len, TxScheduler::COALESCE);
+    }
+
+    /* make an event the value read by clients, notifying is up to the caller */
+    void setEvent(const uint8_t *value, uint16_t len) {
+        ble.gattServer().write(eventCharacteristic.getValueHandle(), value, len, /* local only */ true);
+    }
+
+    /* events go ahead of any stream or bulk frame waiting for the link */
+    void notifyEvent(TxScheduler &tx, const uint8_t *value, uint16_t len) {
+        tx.send(eventCharacteristic.getValueHandle(), value, len, TxScheduler::PRIORITY);
+    }
+
+    /* make a classification the value read by clients, notifying is up to the caller */
+    void setScene(const uint8_t *value) {
+        ble.gattServer().write(sceneCharacteristic.getValueHandle(), value, SCENE_SIZE, /* local only */ true);
+    }
+
+    void notifyScene(TxScheduler &tx, const uint8_t *value) {
+        tx.send(sceneCharacteristic.getValueHandle(), value, SCENE_SIZE, TxScheduler::COALESCE);
+    }
+
+    /* writes to the scene model characteristic are checked by the application before they are accepted */
+    template<typename T>
+    void setSceneModelAuthorization(T *object, void (T::*member)(GattWriteAuthCallbackParams *)) {
+        sceneModelCharacteristic.setWriteAuthorizationCallback(object, member);
+    }
+
+    /* make the scene model in use the value read by clients */
+    void setSceneModel(const uint8_t *value, uint16_t len) {
+        ble.gattServer().write(sceneModelCharacteristic.getValueHandle(), value, len, /* local only */ true);
+    }
+
+    GattAttribute::Handle_t sceneModelHandle() const {
+        return sceneModelCharacteristic.getValueHandle();
+    }
+
+    void updateXYZ(TxScheduler &tx, const uint8_t *value) {
+        tx.send(xyzCharacteristic.getValueHandle(), value, XYZ_SIZE, TxScheduler::COALESCE);
+    }
+
+    /* make a calibrated sample the value read by clients */
+    void setXYZ(const uint8_t *value) {
+        ble.gattServer().write(xyzCharacteristic.getValueHandle(), value, XYZ_SIZE, /* local only */ true);
+    }
+
+    /* writes to the calibration characteristic are checked by the application before they are accepted */
+    template<typename T>
+    void setCalibrationAuthorization(T *object, void (T::*member)(GattWriteAuthCallbackParams *)) {
+        calibrationCharacteristic.setWriteAuthorizationCallback(object, member);
+    }
+
+    /* make the calibration in use the value read by clients */
+    void setCalibration(const Calibration &value) {
+        ble.gattServer().write(calibrationCharacteristic.getValueHandle(), (const uint8_t *) &value, CALIBRATION_SIZE,
+                               /* local only */ true);
+    }
+
+    GattAttribute::Handle_t calibrationHandle() const {
+        return calibrationCharacteristic.getValueHandle();
+    }
+
+    /* writes to the config characteristic are checked by the application before they are accepted */
+    template<typename T>
+    void setConfigAuthorization(T *object, void (T::*member)(GattWriteAuthCallbackParams *)) {
+        configCharacteristic.setWriteAuthorizationCallback(object, member);
+    }
+
+    /* make the configuration in use the value read by clients */
+    void setConfig(const uint8_t *value) {
+        ble.gattServer().write(configCharacteristic.getValueHandle(), value, CONFIG_SIZE, /* local only */ true);
+    }
+
+    GattAttribute::Handle_t configHandle() const {
+        return configCharacteristic.getValueHandle();
+    }
+
+    GattAttribute::Handle_t streamAckHandle() const {
+        return streamAckCharacteristic.getValueHandle();
+    }
+
+    GattAttribute::Handle_t queryHandle() const {
+        return queryCharacteristic.getValueHandle();
+    }
+
+    GattAttribute::Handle_t controlHandle() const {
+        return controlCharacteristic.getValueHandle();
+    }
+
+private:
+    /**
+     * Notify a value longer than `payload`, the central's ATT_MTU less the
+     * ATT header, in parts: the offset of the part, 8 bit, then as many
+     * bytes as fit. Parts are queued in order and never coalesced, as each
+     * would replace the one before; a notification shorter than the value
+     * is always a part. A value that fits goes whole and coalesced.
+     */
+    void notifyValue(TxScheduler &tx, uint16_t payload, GattAttribute::Handle_t handle, const uint8_t *value, uint16_t len) {
+        if (len <= payload) {
+            tx.send(handle, value, len, TxScheduler::COALESCE);
+            return;
+        }
+        uint8_t part[TX_MAX_FRAME];
+        for (uint16_t offset = 0; offset < len; offset += payload - 1) {
+            uint16_t size = len - offset < payload - 1 ? len - offset : payload - 1;
+            part[0] = offset;
+            memcpy(&part[1], &value[offset], size);
+            tx.send(handle, part, 1 + size);
+        }
+    }
+
+    bool isSubscribed(ble::connection_handle_t connection, const GattCharacteristic &characteristic) {
+        bool enabled = false;
+        ble.gattServer().areUpdatesEnabled(connection, characteristic, &enabled);
+        return enabled;
+    }
+
+    BLE& ble;
+    RGBType_t red;
+    RGBType_t green;
+    RGBType_t blue;
+    uint8_t stream[STREAM_MAX_PAYLOAD];
+    uint8_t history[STREAM_MAX_PAYLOAD];
+    uint8_t control[CONTROL_MAX_SIZE];
+    uint8_t rollup[STREAM_MAX_PAYLOAD];
+    uint8_t query[QUERY_RESULT_SIZE];
+    uint8_t stats[STATS_SIZE];
+    uint8_t config[CONFIG_SIZE];
+    uint8_t burst[STREAM_MAX_PAYLOAD];
+    uint8_t flicker[FLICKER_SIZE];
+    uint8_t event[EVENT_SIZE];
+    uint8_t scene[SCENE_SIZE];
+    uint8_t sceneModel[SCENE_MODEL_MAX_SIZE];
+    uint8_t xyz[XYZ_SIZE];
+    uint8_t calibration[CALIBRATION_SIZE];
+    uint8_t counters[COUNTERS_SIZE];
+    uint8_t streamAck[STREAM_ACK_SIZE];
+
+    ReadOnlyGattCharacteristic<RGBType_t> redCharacteristic;
+    ReadOnlyGattCharacteristic<RGBType_t> greenCharacteristic;
+    ReadOnlyGattCharacteristic<RGBType_t> blueCharacteristic;
+    GattCharacteristic streamCharacteristic;
+    GattCharacteristic historyCharacteristic;
+    GattCharacteristic controlCharacteristic;
+    GattCharacteristic rollupCharacteristic;
+    GattCharacteristic queryCharacteristic;
+    GattCharacteristic statsCharacteristic;
+    GattCharacteristic configCharacteristic;
+    GattCharacteristic burstCharacteristic;
+    GattCharacteristic flickerCharacteristic;
+    GattCharacteristic eventCharacteristic;
+    GattCharacteristic sceneCharacteristic;
+    GattCharacteristic sceneModelCharacteristic;
+    GattCharacteristic xyzCharacteristic;
+    GattCharacteristic calibrationCharacteristic;
+    GattCharacteristic countersCharacteristic;
+    GattCharacteristic streamAckCharacteristic;
+};
+
+/* multi-byte fields of the characteristic values are little endian */
+inline uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+inline void put32(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xFF; p[1] = value >> 8; p[2] = value >> 16; p[3] = value >> 24;
+}
+
+#endif
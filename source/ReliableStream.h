@@ -0,0 +1,128 @@
+#ifndef RELIABLE_STREAM_H
+#define RELIABLE_STREAM_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "SampleHistory.h"
+#include "SampleReader.h"
+#include "StreamFrame.h"
+
+/**
+ * Reliable stream: once the gateway acknowledges the stream, its frames are
+ * built from the RAM history or the flash log rather than from new samples,
+ * while fewer than MBED_CONF_APP_RELIABLE_WINDOW samples wait for its ACK,
+ * so the scheduler never has to drop one. If the ACK has not moved after
+ * MBED_CONF_APP_RELIABLE_TIMEOUT_MS the stream goes back to it. A sample
+ * that is neither in RAM nor in flash any more is skipped, and the next
+ * frame starting past it tells the gateway it is gone. Each link keeps its
+ * own state_t.
+ */
+class ReliableStream {
+public:
+    struct state_t {
+        bool enabled;           // the gateway acknowledges the stream, which is sent from the history
+        uint32_t next;          // next sample to send
+        uint32_t acked;         // first sample the gateway has not acknowledged
+        uint64_t progress_ms;   // when the last ACK moved, or the stream went back to it
+    };
+
+    ReliableStream(RGBService &service, const SampleHistory &history, SampleReader &reader) :
+        _service(service),
+        _history(history),
+        _reader(reader)
+    {
+    }
+
+    /* the first ACK turns the stream reliable from the sample it names, later ones move the window */
+    void ack(state_t &stream, uint32_t ack) {
+        if (!stream.enabled) {
+            stream.enabled = true;
+            stream.next = (int32_t) (ack - _history.end()) < 0 ? ack : _history.end();
+            stream.acked = stream.next;
+            stream.progress_ms = Kernel::get_ms_count();
+        } else if ((int32_t) (ack - stream.acked) > 0 && (int32_t) (ack - _history.end()) <= 0) {
+            /* an ACK for frames sent before going back still counts */
+            stream.acked = ack;
+            if (stream.next < ack) stream.next = ack;
+            stream.progress_ms = Kernel::get_ms_count();
+        }
+    }
+
+    /* samples were sent that the gateway has not acknowledged */
+    static bool waiting(const state_t &stream) {
+        return stream.enabled && stream.next != stream.acked;
+    }
+
+    /* ms until a waiting stream times out at `now`, 0 once it has; a pump after `now` was read may have moved
+     * progress_ms past it */
+    static uint32_t left(const state_t &stream, uint64_t now) {
+        uint32_t left = MBED_CONF_APP_RELIABLE_TIMEOUT_MS - (uint32_t) (now - stream.progress_ms);
+        return (int32_t) left > 0 ? left : 0;
+    }
+
+    /* go back to the first sample not acknowledged, returns how many are sent again */
+    static uint32_t rewind(state_t &stream) {
+        uint32_t again = stream.next - stream.acked;
+        stream.next = stream.acked;
+        return again;
+    }
+
+    /**
+     * Send frames of `per_frame` samples in `layout` through `batch` while the
+     * link has TX buffers and the window is open; the samples queued are
+     * added to `queued`. A partial frame of new samples waits until its
+     * oldest sample is `flush_ms` old: pump() then stops and returns how long
+     * is left, for the caller to pump again then, or at once with a
+     * `flush_ms` of 0 if it cannot wait. Otherwise it returns 0.
+     */
+    uint32_t pump(state_t &stream, StreamFrame &batch, SampleReader::cursor_t &cursor, TxScheduler &tx,
+                  uint16_t per_frame, uint8_t layout, uint32_t flush_ms, uint32_t &queued) {
+        while (tx.ready()) {
+            uint32_t end = _history.end();
+            bool limited = end - stream.acked > MBED_CONF_APP_RELIABLE_WINDOW;
+            if (limited) {
+                end = stream.acked + MBED_CONF_APP_RELIABLE_WINDOW;
+            }
+            if (stream.next >= end) {
+                break;
+            }
+            if (!limited && end - stream.next < per_frame && stream.next >= _history.begin()) {
+                uint32_t age = _reader.age(stream.next);
+                if (age < flush_ms) {
+                    return flush_ms - age;
+                }
+            }
+
+            /* the timeout runs from the first frame the gateway has to acknowledge */
+            bool first = stream.next == stream.acked;
+            while (batch.samples() < per_frame && stream.next < end) {
+                SampleHistory::sample_t sample;
+                uint32_t sequence = _reader.fetch(cursor, stream.next, sample);
+                if (sequence != stream.next && batch.samples() > 0) {
+                    break;
+                }
+                stream.next = sequence;
+                if (sequence >= end) {
+                    break;
+                }
+                batch.append(layout, sequence, Kernel::get_ms_count(), sample.r, sample.g, sample.b);
+                stream.next++;
+            }
+            if (batch.samples() == 0) {
+                break;
+            }
+            if (first) {
+                stream.progress_ms = Kernel::get_ms_count();
+            }
+            queued += batch.send(_service, tx);
+        }
+        return 0;
+    }
+
+private:
+    RGBService &_service;
+    const SampleHistory &_history;
+    SampleReader &_reader;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef ROLLUP_PUBLISHER_H
+#define ROLLUP_PUBLISHER_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "RollupStore.h"
+
+/**
+ * Rollups on the rollup characteristic. Every sample goes into the
+ * RollupStore; a client asks for a run of periods of one level with a
+ * control request and gets them packed in frames, consecutive periods in
+ * each, then an empty frame. Each link keeps its own request_t.
+ */
+class RollupPublisher {
+public:
+    struct request_t {
+        bool pending;
+        uint8_t level;
+        uint64_t next;          // start of the next period to send
+        uint16_t left;
+    };
+
+    RollupPublisher(RGBService &service) :
+        _service(service)
+    {
+    }
+
+    void add(uint64_t time_ms, uint16_t r, uint16_t g, uint16_t b) {
+        _rollups.add(time_ms, r, g, b);
+    }
+
+    /* ask for `count` periods of a level from the one holding `start_ms`, false if there is no such level */
+    static bool request(request_t &request, uint8_t level, uint64_t start_ms, uint16_t count) {
+        if (level >= RollupStore::LEVELS) {
+            return false;
+        }
+        request.level = level;
+        request.next = start_ms / RollupStore::period(level) * RollupStore::period(level);
+        request.left = count;
+        request.pending = true;
+        return true;
+    }
+
+    /* send what a request has left while the transmit queue has room, in frames of `payload` bytes */
+    void pump(request_t &request, TxScheduler &tx, uint16_t payload) {
+        uint16_t per_frame = (payload - RGBService::ROLLUP_HEADER_SIZE) / RGBService::ROLLUP_SIZE;
+        uint32_t period = RollupStore::period(request.level);
+        uint8_t frame[RGBService::STREAM_MAX_PAYLOAD];
+        while (request.pending && tx.ready()) {
+            frame[0] = request.level;
+            put32(&frame[1], request.next);
+            uint8_t *p = frame + RGBService::ROLLUP_HEADER_SIZE;
+            uint16_t count = 0;
+            RollupStore::rollup_t rollup;
+            while (count < per_frame && request.left > 0) {
+                /* periods not held are sent empty so the frame stays a run of consecutive periods */
+                if (!_rollups.get(request.level, request.next, rollup)) {
+                    memset(&rollup, 0, sizeof(rollup));
+                }
+                const uint16_t values[10] = {
+                    rollup.count, rollup.min[0], rollup.min[1], rollup.min[2],
+                    rollup.max[0], rollup.max[1], rollup.max[2], rollup.mean[0], rollup.mean[1], rollup.mean[2]
+                };
+                for (uint8_t i = 0; i < 10; i++) {
+                    p[2 * i] = values[i] & 0xFF;
+                    p[2 * i + 1] = values[i] >> 8;
+                }
+                p += RGBService::ROLLUP_SIZE;
+                request.next += period;
+                request.left--;
+                count++;
+            }
+
+            if (count == 0) {
+                request.pending = false;
+            }
+            _service.updateRollup(tx, frame, p - frame);
+        }
+    }
+
+private:
+    RGBService &_service;
+    RollupStore _rollups;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef ROLLUP_STORE_H
+#define ROLLUP_STORE_H
+
+#include <mbed.h>
+
+/**
+ * Round robin store of per-period min, max, mean and count of the samples,
+ * kept at several resolutions at once.
+ *
+ * Level 0 rolls samples up by the minute, level 1 by the quarter hour and
+ * level 2 by the hour, each in a fixed ring of MBED_CONF_APP_ROLLUP_*
+ * periods. Periods start at multiples of their length in log time, and a
+ * period without samples is kept with a count of 0. Every sample updates
+ * the open period of each level; the rollup is written to its ring when
+ * the next period starts.
+ */
+class RollupStore {
+public:
+    static const uint8_t LEVELS = 3;
+
+    struct rollup_t {
+        uint16_t count;
+        uint16_t min[3];    // R, G, B
+        uint16_t max[3];
+        uint16_t mean[3];
+    };
+
+    RollupStore() :
+        _started(false)
+    {
+        const uint16_t depth[LEVELS] = {
+            MBED_CONF_APP_ROLLUP_MINUTES, MBED_CONF_APP_ROLLUP_QUARTERS, MBED_CONF_APP_ROLLUP_HOURS
+        };
+        uint16_t offset = 0;
+        for (uint8_t i = 0; i < LEVELS; i++) {
+            _levels[i].offset = offset;
+            _levels[i].depth = depth[i];
+            offset += depth[i];
+        }
+        memset(_slots, 0, sizeof(_slots));
+    }
+
+    /* length of a period of a level in ms */
+    static uint32_t period(uint8_t level) {
+        return level == 0 ? 60000 : level == 1 ? 900000 : 3600000;
+    }
+
+    /* periods held for a level, the open one not included */
+    uint16_t depth(uint8_t level) const {
+        return _levels[level].depth;
+    }
+
+    void add(uint64_t time_ms, uint16_t r, uint16_t g, uint16_t b) {
+        const uint16_t value[3] = { r, g, b };
+        for (uint8_t i = 0; i < LEVELS; i++) {
+            level_t &level = _levels[i];
+            uint32_t index = time_ms / period(i);
+            if (!_started) {
+                level.first = index;
+                level.open = index;
+                clear(level);
+            } else if (index != level.open) {
+                close(level, index);
+            }
+
+            for (uint8_t c = 0; c < 3; c++) {
+                if (level.count == 0 || value[c] < level.min[c]) level.min[c] = value[c];
+                if (level.count == 0 || value[c] > level.max[c]) level.max[c] = value[c];
+                level.sum[c] += value[c];
+            }
+            level.count++;
+        }
+        _started = true;
+    }
+
+    /* rollup of the period of a level starting at start_ms, the open period included; false if it is not held */
+    bool get(uint8_t level_index, uint64_t start_ms, rollup_t &rollup) const {
+        const level_t &level = _levels[level_index];
+        uint32_t index = start_ms / period(level_index);
+        if (!_started || index < level.first || index > level.open || level.open - index > level.depth) {
+            return false;
+        }
+        if (index == level.open) {
+            summarize(level, rollup);
+        } else {
+            rollup = _slots[level.offset + index % level.depth];
+        }
+        return true;
+    }
+
+private:
+    struct level_t {
+        uint16_t offset;    // first slot of the level in _slots
+        uint16_t depth;
+        uint32_t first;     // index of the first period with samples
+        uint32_t open;      // index of the open period, start time / period
+        uint32_t count;
+        uint16_t min[3];
+        uint16_t max[3];
+        uint32_t sum[3];
+    };
+
+    /* store the open period and the empty ones up to `index`, which becomes the open one */
+    void close(level_t &level, uint32_t index) {
+        summarize(level, _slots[level.offset + level.open % level.depth]);
+        uint32_t empty = index - level.open - 1;
+        if (empty > level.depth) {
+            empty = level.depth;
+        }
+        for (uint32_t k = 1; k <= empty; k++) {
+            memset(&_slots[level.offset + (index - k) % level.depth], 0, sizeof(rollup_t));
+        }
+        level.open = index;
+        clear(level);
+    }
+
+    static void clear(level_t &level) {
+        level.count = 0;
+        memset(level.sum, 0, sizeof(level.sum));
+    }
+
+    static void summarize(const level_t &level, rollup_t &rollup) {
+        rollup.count = level.count > 0xFFFF ? 0xFFFF : level.count;
+        for (uint8_t c = 0; c < 3; c++) {
+            rollup.min[c] = level.count ? level.min[c] : 0;
+            rollup.max[c] = level.count ? level.max[c] : 0;
+            rollup.mean[c] = level.count ? (level.sum[c] + level.count / 2) / level.count : 0;
+        }
+    }
+
+    bool _started;
+    level_t _levels[LEVELS];
+    rollup_t _slots[MBED_CONF_APP_ROLLUP_MINUTES + MBED_CONF_APP_ROLLUP_QUARTERS + MBED_CONF_APP_ROLLUP_HOURS];
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef RUNNING_STATS_H
+#define RUNNING_STATS_H
+
+#include <stdint.h>
+
+/**
+ * Welford running mean and variance of one channel in fixed point.
+ *
+ * The mean is kept with FRACTION fractional bits and the sum of squared
+ * deviations with twice as many, so updates need no floating point and
+ * stay exact to well under one count. Samples can be removed again in any
+ * order, which lets a caller slide a window over a stream; rounding of the
+ * mean then builds up slowly, so such a caller should reseed from time to
+ * time with reset() and add().
+ */
+class RunningStats {
+public:
+    static const uint8_t FRACTION = 8;
+
+    RunningStats() {
+        reset();
+    }
+
+    void reset() {
+        _count = 0;
+        _mean = 0;
+        _m2 = 0;
+    }
+
+    void add(uint16_t value) {
+        int32_t x = (int32_t) value << FRACTION;
+        _count++;
+        int32_t delta = x - _mean;
+        _mean += divide(delta, _count);
+        _m2 += (int64_t) delta * (x - _mean);
+    }
+
+    void remove(uint16_t value) {
+        if (_count <= 1) {
+            reset();
+            return;
+        }
+        int32_t x = (int32_t) value << FRACTION;
+        _count--;
+        int32_t delta = x - _mean;
+        _mean -= divide(delta, _count);
+        _m2 -= (int64_t) delta * (x - _mean);
+        if (_m2 < 0) {
+            _m2 = 0;
+        }
+    }
+
+    uint32_t count() const {
+        return _count;
+    }
+
+    /* mean with FRACTION fractional bits */
+    uint32_t mean() const {
+        return _mean;
+    }
+
+    /* sample variance in counts squared, saturated to 32 bits */
+    uint32_t variance() const {
+        if (_count < 2) {
+            return 0;
+        }
+        uint64_t variance = ((uint64_t) _m2 / (_count - 1)) >> (2 * FRACTION);
+        return variance > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) variance;
+    }
+
+private:
+    static int32_t divide(int32_t value, uint32_t by) {
+        return value >= 0 ? (value + (int32_t) (by / 2)) / (int32_t) by : -((-value + (int32_t) (by / 2)) / (int32_t) by);
+    }
+
+    uint32_t _count;
+    int32_t _mean;
+    int64_t _m2;
+};
+
+#endif
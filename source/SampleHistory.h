@@ -0,0 +1,218 @@
+#ifndef SAMPLE_HISTORY_H
+#define SAMPLE_HISTORY_H
+
+#include <mbed.h>
+#include "Pack12.h"
+
+/**
+ * Ring of the most recent sensor samples, filled whether or not a central
+ * is connected.
+ *
+ * Every sample gets a sequence number, one more than the previous one, and
+ * keeps the time it was taken. Once MBED_CONF_APP_HISTORY_DEPTH samples are
+ * held each new one overwrites the oldest, so the sequence numbers held are
+ * always the contiguous range [begin(), end()).
+ *
+ * A segment tree over BLOCKS blocks keeps the count, min, max and sum of
+ * every block and block range, updated on each push. summarize() takes
+ * whole blocks from the tree and scans only the partial blocks at the ends
+ * of a range, so a query costs O(block + log(BLOCKS)).
+ *
+ * Restarted packed, for samples of the sensor's 12 bit resolution, the same
+ * memory holds samples in pairs of PAIR_SIZE bytes, the two times then the
+ * six values through Pack12, and a block is PACKED_BLOCK samples instead of
+ * BLOCK: a third more samples in the ring. The first sample of a pair waits
+ * unpacked until the second comes.
+ */
+class SampleHistory {
+public:
+    struct sample_t {
+        uint32_t time_ms;   // log time the sample was taken, see FlashLog
+        uint16_t r;
+        uint16_t g;
+        uint16_t b;
+    };
+
+    struct summary_t {
+        uint32_t count;
+        uint16_t min[3];    // R, G, B
+        uint16_t max[3];
+        uint32_t sum[3];
+    };
+
+    static const uint16_t BLOCK = 16;
+    static const uint16_t BLOCKS = MBED_CONF_APP_HISTORY_DEPTH / BLOCK;
+    static const uint16_t PAIR_SIZE = 2 * sizeof(uint32_t) + Pack12::size(6);
+    /* as many whole pairs as the memory of BLOCK samples holds */
+    static const uint16_t PACKED_BLOCK = BLOCK * sizeof(sample_t) / PAIR_SIZE * 2;
+
+    SampleHistory() :
+        _first(0),
+        _end(0),
+        _packed(false),
+        _block(BLOCK)
+    {
+        memset(_tree, 0, sizeof(_tree));
+    }
+
+    /* forget every sample, the next one gets sequence number `first`; packed keeps only 12 bit values */
+    void restart(uint32_t first, bool packed = false) {
+        _first = first;
+        _end = first;
+        _packed = packed;
+        _block = packed ? PACKED_BLOCK : BLOCK;
+        memset(_tree, 0, sizeof(_tree));
+    }
+
+    bool packed() const {
+        return _packed;
+    }
+
+    /* samples the ring holds */
+    uint32_t capacity() const {
+        return (uint32_t) _block * BLOCKS;
+    }
+
+    void push(uint32_t time_ms, uint16_t r, uint16_t g, uint16_t b) {
+        sample_t sample = { time_ms, r, g, b };
+        if (!_packed) {
+            _samples[_end % MBED_CONF_APP_HISTORY_DEPTH] = sample;
+        } else if (_end % 2 == 0) {
+            _pending = sample;
+        } else {
+            uint8_t *pair = &_pairs[(_end / 2) % (capacity() / 2) * PAIR_SIZE];
+            const uint16_t values[6] = { _pending.r, _pending.g, _pending.b, r, g, b };
+            memcpy(pair, &_pending.time_ms, sizeof(uint32_t));
+            memcpy(pair + sizeof(uint32_t), &time_ms, sizeof(uint32_t));
+            Pack12::pack(values, 6, pair + 2 * sizeof(uint32_t));
+        }
+
+        /* a block starting over drops the summary of the samples it overwrites */
+        uint16_t node = BLOCKS + (_end / _block) % BLOCKS;
+        if (_end % _block == 0) {
+            memset(&_tree[node], 0, sizeof(summary_t));
+        }
+        add(_tree[node], sample);
+        for (node /= 2; node > 0; node /= 2) {
+            _tree[node] = _tree[2 * node];
+            merge(_tree[node], _tree[2 * node + 1]);
+        }
+        _end++;
+    }
+
+    /* sequence number of the oldest sample held */
+    uint32_t begin() const {
+        return _end - _first > capacity() ? _end - capacity() : _first;
+    }
+
+    /* sequence number the next sample will get */
+    uint32_t end() const {
+        return _end;
+    }
+
+    /* sample with a sequence number in [begin(), end()) */
+    sample_t at(uint32_t sequence) const {
+        if (!_packed) {
+            return _samples[sequence % MBED_CONF_APP_HISTORY_DEPTH];
+        }
+        if (sequence % 2 == 0 && sequence + 1 == _end) {
+            return _pending;
+        }
+        /* the pair of a waiting sample still holds the two it will overwrite */
+        const uint8_t *pair = &_pairs[(sequence / 2) % (capacity() / 2) * PAIR_SIZE];
+        uint16_t values[6];
+        Pack12::unpack(pair + 2 * sizeof(uint32_t), 6, values);
+        uint8_t half = sequence % 2;
+        sample_t sample;
+        memcpy(&sample.time_ms, pair + half * sizeof(uint32_t), sizeof(uint32_t));
+        sample.r = values[3 * half];
+        sample.g = values[3 * half + 1];
+        sample.b = values[3 * half + 2];
+        return sample;
+    }
+
+    /* count, min, max and sum of the samples held in [first, end), false if there is none */
+    bool summarize(uint32_t first, uint32_t end, summary_t &summary) const {
+        memset(&summary, 0, sizeof(summary));
+        if (first < begin()) first = begin();
+        if (end > _end) end = _end;
+        if (first >= end) {
+            return false;
+        }
+
+        uint32_t first_block = (first + _block - 1) / _block;
+        uint32_t end_block = end / _block;
+        if (first_block >= end_block) {
+            scan(first, end, summary);
+            return true;
+        }
+        scan(first, first_block * _block, summary);
+        scan(end_block * _block, end, summary);
+
+        /* whole blocks, in one or two runs of the ring */
+        uint16_t from = first_block % BLOCKS;
+        uint16_t count = end_block - first_block;
+        if (from + count <= BLOCKS) {
+            query(from, from + count, summary);
+        } else {
+            query(from, BLOCKS, summary);
+            query(0, from + count - BLOCKS, summary);
+        }
+        return true;
+    }
+
+    /* fold one more sample into a summary, for samples read back from elsewhere */
+    static void add(summary_t &summary, const sample_t &sample) {
+        const uint16_t value[3] = { sample.r, sample.g, sample.b };
+        for (uint8_t c = 0; c < 3; c++) {
+            if (summary.count == 0 || value[c] < summary.min[c]) summary.min[c] = value[c];
+            if (summary.count == 0 || value[c] > summary.max[c]) summary.max[c] = value[c];
+            summary.sum[c] += value[c];
+        }
+        summary.count++;
+    }
+
+private:
+    static void merge(summary_t &summary, const summary_t &other) {
+        if (other.count == 0) {
+            return;
+        }
+        for (uint8_t c = 0; c < 3; c++) {
+            if (summary.count == 0 || other.min[c] < summary.min[c]) summary.min[c] = other.min[c];
+            if (summary.count == 0 || other.max[c] > summary.max[c]) summary.max[c] = other.max[c];
+            summary.sum[c] += other.sum[c];
+        }
+        summary.count += other.count;
+    }
+
+    void scan(uint32_t first, uint32_t end, summary_t &summary) const {
+        for (uint32_t sequence = first; sequence < end; sequence++) {
+            add(summary, at(sequence));
+        }
+    }
+
+    /* merge the blocks [from, to) of the ring */
+    void query(uint16_t from, uint16_t to, summary_t &summary) const {
+        for (from += BLOCKS, to += BLOCKS; from < to; from /= 2, to /= 2) {
+            if (from & 1) merge(summary, _tree[from++]);
+            if (to & 1) merge(summary, _tree[--to]);
+        }
+    }
+
+    union {
+        sample_t _samples[MBED_CONF_APP_HISTORY_DEPTH];
+        uint8_t _pairs[MBED_CONF_APP_HISTORY_DEPTH * sizeof(sample_t)];
+    };
+    summary_t _tree[2 * BLOCKS];    // node 1 is the root, the blocks are nodes BLOCKS to 2 * BLOCKS - 1
+    uint32_t _first;
+    uint32_t _end;
+    bool _packed;
+    uint16_t _block;                // samples per block
+    sample_t _pending;              // first sample of a pair, packed
+};
+
+static_assert(MBED_CONF_APP_HISTORY_DEPTH % SampleHistory::BLOCK == 0, "history depth must be a multiple of SampleHistory::BLOCK");
+static_assert(SampleHistory::PACKED_BLOCK % 2 == 0 && SampleHistory::PACKED_BLOCK * 3 >= SampleHistory::BLOCK * 4,
+              "packed blocks must be whole pairs and a third larger");
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef SAMPLE_LOG_H
+#define SAMPLE_LOG_H
+
+#include <mbed.h>
+#include "FlashLog.h"
+#include "LogFlash.h"
+
+/* the flash log of the samples, in the sectors below the KVStore and the bond database */
+typedef FlashLog<LogFlash, MBED_CONF_APP_FLASH_LOG_BLOCK_SIZE> SampleLog;
+
+#endif
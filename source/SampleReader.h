@@ -0,0 +1,95 @@
+#ifndef SAMPLE_READER_H
+#define SAMPLE_READER_H
+
+#include <mbed.h>
+#include "SampleHistory.h"
+#include "SampleLog.h"
+
+/**
+ * Samples read back by number or time, from the RAM history or, for the
+ * ones it no longer holds, the flash log. A central reading the log keeps
+ * a cursor_t, so a run of samples is decoded on from the last one rather
+ * than sought again for each.
+ */
+class SampleReader {
+public:
+    struct cursor_t {
+        SampleLog::cursor_t log;
+        uint32_t next;          // sequence number next() on the log cursor returns
+    };
+
+    SampleReader(const SampleHistory &history, SampleLog &log) :
+        _history(history),
+        _log(log)
+    {
+    }
+
+    /* the next fetch() seeks the log again */
+    static void reset(cursor_t &cursor) {
+        cursor.log.valid = false;
+    }
+
+    /* log time of a time on the wire: the latest one with those 32 low bits, not after now */
+    uint64_t unwrapTime(uint32_t time_ms) const {
+        uint64_t now = _log.time(Kernel::get_ms_count());
+        return now - (uint32_t) ((uint32_t) now - time_ms);
+    }
+
+    /* ms since sample `sequence` of the RAM history was taken */
+    uint32_t age(uint32_t sequence) const {
+        return (uint32_t) _log.time(Kernel::get_ms_count()) - _history.at(sequence).time_ms;
+    }
+
+    /* first sample taken at or after a time on the wire */
+    uint32_t sequenceAt(uint32_t time_ms) {
+        uint32_t lo = _history.begin();
+        uint32_t hi = _history.end();
+        /* RAM times are the low 32 bits too, the history spans far less than their 49 day turn */
+        if (lo == hi || (int32_t) (_history.at(lo).time_ms - time_ms) > 0) {
+            SampleLog::cursor_t cursor;
+            SampleLog::record_t record;
+            if (_log.seek(cursor, unwrapTime(time_ms), true) && _log.next(cursor, record) && record.sequence < lo) {
+                return record.sequence;
+            }
+            return lo;
+        }
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if ((int32_t) (_history.at(mid).time_ms - time_ms) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    /* sample `sequence` or, if it is gone, the next one held; returns the sequence number of what it got */
+    uint32_t fetch(cursor_t &cursor, uint32_t sequence, SampleHistory::sample_t &sample) {
+        if (sequence < _history.begin()) {
+            SampleLog::record_t record;
+            if ((cursor.log.valid && cursor.next == sequence && _log.next(cursor.log, record)) ||
+                (_log.seek(cursor.log, sequence, false) && _log.next(cursor.log, record))) {
+                cursor.next = record.sequence + 1;
+                if (record.sequence < _history.begin()) {
+                    sample.time_ms = record.time_ms;
+                    sample.r = record.r;
+                    sample.g = record.g;
+                    sample.b = record.b;
+                    return record.sequence;
+                }
+            }
+            sequence = _history.begin();
+        }
+        if (sequence < _history.end()) {
+            sample = _history.at(sequence);
+        }
+        return sequence;
+    }
+
+private:
+    const SampleHistory &_history;
+    SampleLog &_log;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef SCENE_CLASSIFIER_H
+#define SCENE_CLASSIFIER_H
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Nearest centroid classification of a sample into one of up to
+ * MAX_SCENES known lighting scenes, integer arithmetic only.
+ *
+ * A sample is reduced to its chromaticity, r / (r + g + b) and
+ * g / (r + g + b) with CHROMA_BITS fractional bits, so a scene is
+ * recognised whatever its brightness. The class is the index of the nearest
+ * centroid by squared distance; a sample farther than max_distance from all
+ * of them, or darker than min_counts in total, is UNKNOWN. The confidence
+ * is the margin over the runner-up, 255 * (d2 - d1) / (d2 + d1) on squared
+ * distances, or with a single centroid how far inside max_distance the
+ * sample is.
+ *
+ * Only <stdint.h> and <string.h> are needed, so the bench can build it on
+ * the host.
+ */
+template<uint8_t MAX_SCENES>
+class SceneClassifier {
+public:
+    static const uint8_t CHROMA_BITS = 10;
+    static const uint16_t CHROMA_ONE = 1 << CHROMA_BITS;
+    static const uint8_t UNKNOWN = 0xFF;
+
+    struct centroid_t {
+        uint16_t r;     // chromaticity, CHROMA_BITS fractional bits
+        uint16_t g;
+    };
+
+    /* what is kept in storage */
+    struct model_t {
+        uint8_t count;
+        centroid_t centroids[MAX_SCENES];
+    };
+
+    SceneClassifier(uint32_t min_counts, uint16_t max_distance) :
+        _min_counts(min_counts),
+        _max_distance2(0)
+    {
+        /* no two chromaticities are farther apart than 2 * CHROMA_ONE */
+        uint32_t distance = max_distance < 2 * CHROMA_ONE ? max_distance : 2 * CHROMA_ONE;
+        _max_distance2 = distance * distance;
+        memset(&_model, 0, sizeof(_model));
+    }
+
+    /* false if the model has too many centroids or one of them is not a chromaticity */
+    static bool valid(const model_t &model) {
+        if (model.count > MAX_SCENES) {
+            return false;
+        }
+        for (uint8_t i = 0; i < model.count; i++) {
+            if ((uint32_t) model.centroids[i].r + model.centroids[i].g > CHROMA_ONE) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void load(const model_t &model) {
+        _model = model;
+    }
+
+    const model_t &model() const {
+        return _model;
+    }
+
+    /* class of a sample, UNKNOWN if there is no centroid near enough */
+    uint8_t classify(uint16_t r, uint16_t g, uint16_t b, uint8_t &confidence) const {
+        confidence = 0;
+        uint32_t sum = (uint32_t) r + g + b;
+        if (_model.count == 0 || sum < _min_counts || sum == 0) {
+            return UNKNOWN;
+        }
+        int32_t cr = ((uint32_t) r << CHROMA_BITS) / sum;
+        int32_t cg = ((uint32_t) g << CHROMA_BITS) / sum;
+
+        uint8_t nearest = 0;
+        uint32_t d1 = 0xFFFFFFFF;
+        uint32_t d2 = 0xFFFFFFFF;
+        for (uint8_t i = 0; i < _model.count; i++) {
+            int32_t dr = cr - _model.centroids[i].r;
+            int32_t dg = cg - _model.centroids[i].g;
+            uint32_t d = (uint32_t) (dr * dr + dg * dg);
+            if (d < d1) {
+                d2 = d1;
+                d1 = d;
+                nearest = i;
+            } else if (d < d2) {
+                d2 = d;
+            }
+        }
+        if (d1 > _max_distance2) {
+            return UNKNOWN;
+        }
+
+        /* squared distances are at most 2^21, so 255 times them fits in 32 bits */
+        if (_model.count > 1) {
+            confidence = d1 + d2 > 0 ? 255 * (d2 - d1) / (d2 + d1) : 0;
+        } else {
+            confidence = _max_distance2 > 0 ? 255 * (_max_distance2 - d1) / _max_distance2 : 255;
+        }
+        return nearest;
+    }
+
+private:
+    uint32_t _min_counts;
+    uint32_t _max_distance2;
+    model_t _model;
+};
+
+#endif
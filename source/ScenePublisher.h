@@ -0,0 +1,152 @@
+#ifndef SCENE_PUBLISHER_H
+#define SCENE_PUBLISHER_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "SceneClassifier.h"
+#include "storage.h"
+
+typedef SceneClassifier<MBED_CONF_APP_SCENE_MAX> Scenes;
+
+/**
+ * The scene and scene model characteristics. Each sample is classified
+ * against the model the gateway wrote last, kept in KVStore; only the
+ * class and its confidence go out, notified when the class changes.
+ */
+class ScenePublisher {
+public:
+    ScenePublisher(RGBService &service) :
+        _service(service),
+        _scenes(MBED_CONF_APP_SCENE_MIN_COUNTS, MBED_CONF_APP_SCENE_MAX_DISTANCE),
+        _scene(Scenes::UNKNOWN)
+    {
+        memset(_value, 0, sizeof(_value));
+    }
+
+    /* boot with the model written last */
+    void start() {
+        Scenes::model_t model;
+        if (storage_load(STORAGE_KEY("scenes"), model) && Scenes::valid(model)) {
+            load(model);
+        }
+#if MBED_CONF_APP_SCENE_BENCHMARK
+        benchmark();
+#endif
+    }
+
+    /* classify a sample, true when its class is not the one notified last, for the caller to notify */
+    bool update(uint16_t r, uint16_t g, uint16_t b) {
+        if (_scenes.model().count == 0) {
+            return false;
+        }
+        _value[0] = _scenes.classify(r, g, b, _value[1]);
+        _service.setScene(_value);
+        if (_value[0] == _scene) {
+            return false;
+        }
+        _scene = _value[0];
+        return true;
+    }
+
+    void notify(TxScheduler &tx, uint16_t payload) {
+        _service.notifyScene(tx, _value);
+    }
+
+    /* reply to a model write from a central allowed to make it: whole centroids, all of them valid */
+    void authorize(GattWriteAuthCallbackParams *params) {
+        Scenes::model_t model;
+        if (params->offset != 0 || params->len % RGBService::SCENE_CENTROID_SIZE != 0 ||
+            params->len > RGBService::SCENE_MODEL_MAX_SIZE) {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+        } else if (!decode(params->data, params->len, model) || !Scenes::valid(model)) {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_OUT_OF_RANGE;
+        } else {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
+        }
+    }
+
+    /* a model write went through authorize(), it replaces the one in use and in storage */
+    void written(const uint8_t *data, uint16_t len) {
+        Scenes::model_t model;
+        decode(data, len, model);
+        load(model);
+        storage_save(STORAGE_KEY("scenes"), model);
+    }
+
+private:
+    static bool decode(const uint8_t *data, uint16_t len, Scenes::model_t &model) {
+        if (len > RGBService::SCENE_MODEL_MAX_SIZE) {
+            return false;
+        }
+        memset(&model, 0, sizeof(model));
+        model.count = len / RGBService::SCENE_CENTROID_SIZE;
+        for (uint8_t i = 0; i < model.count; i++) {
+            model.centroids[i].r = data[4 * i] | (data[4 * i + 1] << 8);
+            model.centroids[i].g = data[4 * i + 2] | (data[4 * i + 3] << 8);
+        }
+        return true;
+    }
+
+    void load(const Scenes::model_t &model) {
+        _scenes.load(model);
+        _scene = Scenes::UNKNOWN;
+        uint8_t value[RGBService::SCENE_MODEL_MAX_SIZE];
+        for (uint8_t i = 0; i < model.count; i++) {
+            value[4 * i] = model.centroids[i].r & 0xFF; value[4 * i + 1] = model.centroids[i].r >> 8;
+            value[4 * i + 2] = model.centroids[i].g & 0xFF; value[4 * i + 3] = model.centroids[i].g >> 8;
+        }
+        _service.setSceneModel(value, model.count * RGBService::SCENE_CENTROID_SIZE);
+        printf("Scene model: %u centroids\r\n", model.count);
+    }
+
+#if MBED_CONF_APP_SCENE_BENCHMARK
+    /**
+     * Cycles per classification on this core, against a full model of made
+     * up scenes. M3 and up count them with the DWT cycle counter; an M0 has
+     * none, and NRF51 targets leave SysTick to the SoftDevice, so there the
+     * loop is timed with a Timer and scaled by SystemCoreClock. Interrupts
+     * taken during the loop are counted in either way.
+     */
+    static void benchmark() {
+        Scenes::model_t model;
+        model.count = MBED_CONF_APP_SCENE_MAX;
+        for (uint8_t i = 0; i < model.count; i++) {
+            model.centroids[i].r = 440 - 30 * i;
+            model.centroids[i].g = 360 + (i % 2 ? 25 : 0);
+        }
+        Scenes scenes(MBED_CONF_APP_SCENE_MIN_COUNTS, MBED_CONF_APP_SCENE_MAX_DISTANCE);
+        scenes.load(model);
+
+        const uint32_t runs = 10000;
+        volatile uint8_t sink = 0;
+#if defined(__CORTEX_M) && __CORTEX_M >= 3
+        /* the cycle counter runs without a debugger attached once trace is enabled */
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        uint32_t start = DWT->CYCCNT;
+#else
+        Timer timer;
+        timer.start();
+#endif
+        for (uint32_t i = 0; i < runs; i++) {
+            uint8_t confidence;
+            sink = scenes.classify(400 + (i & 63), 350 + (i & 31), 250, confidence);
+        }
+#if defined(__CORTEX_M) && __CORTEX_M >= 3
+        uint32_t cycles = DWT->CYCCNT - start;
+#else
+        uint32_t cycles = (uint32_t) ((uint64_t) timer.read_us() * (SystemCoreClock / 1000000));
+#endif
+        (void) sink;
+        printf("Scene benchmark: %lu cycles per classification at %lu MHz\r\n",
+               (unsigned long) (cycles / runs), (unsigned long) (SystemCoreClock / 1000000));
+    }
+#endif
+
+    RGBService &_service;
+    Scenes _scenes;
+    uint8_t _scene;             // class last notified
+    uint8_t _value[RGBService::SCENE_SIZE];
+};
+
+#endif
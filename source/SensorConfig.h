@@ -0,0 +1,88 @@
+#ifndef SENSOR_CONFIG_H
+#define SENSOR_CONFIG_H
+
+#include <mbed.h>
+#include "ISL29125.h"
+#include "RGBService.h"
+
+/* stream sample encodings */
+#define STREAM_ENCODING_16BIT 0
+#define STREAM_ENCODING_PERCEPTUAL 1
+
+/* shortest sampling period: the sensor converts G, R and B one after the other, 100 ms each at 16 bit, 6.25 ms at 12 bit */
+#define CONFIG_MIN_PERIOD_16BIT_MS 300
+#define CONFIG_MIN_PERIOD_12BIT_MS 20
+#define CONFIG_MAX_PERIOD_MS 3600000
+#define CONFIG_MAX_FLUSH_MS 60000
+
+/**
+ * Acquisition settings, written by a client on the config characteristic
+ * and kept in KVStore as they are laid out here; the characteristic value
+ * is laid out in RGBService.h.
+ */
+struct SensorConfig {
+    uint32_t period_ms;
+    uint8_t range;          // ISL29125_375LX or ISL29125_10KLX
+    uint8_t resolution;     // ISL29125_16BIT or ISL29125_12BIT
+    uint16_t flush_ms;      // longest a sample waits in a stream or history frame
+    uint8_t encoding;       // STREAM_ENCODING_16BIT or STREAM_ENCODING_PERCEPTUAL
+
+    /* what the node samples with until a client writes a configuration */
+    static SensorConfig defaults() {
+        SensorConfig config;
+        config.period_ms = MBED_CONF_APP_SAMPLE_PERIOD_MS;
+        config.range = ISL29125_10KLX;
+        config.resolution = ISL29125_16BIT;
+        config.flush_ms = MBED_CONF_APP_STREAM_FLUSH_MS;
+        config.encoding = STREAM_ENCODING_16BIT;
+        return config;
+    }
+
+    /* reply to a configuration write from a central allowed to make it: every field has to be valid */
+    static void authorize(GattWriteAuthCallbackParams *params) {
+        SensorConfig config;
+        if (params->offset != 0 || params->len != RGBService::CONFIG_SIZE) {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+        } else if (!config.decode(params->data) || !config.valid()) {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_OUT_OF_RANGE;
+        } else {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
+        }
+    }
+
+    /* read a characteristic value, false if a field is out of its encoding */
+    bool decode(const uint8_t *data) {
+        if (data[4] > 1 || data[5] > 1 || data[8] > STREAM_ENCODING_PERCEPTUAL) {
+            return false;
+        }
+        period_ms = get32(data);
+        range = data[4] ? ISL29125_10KLX : ISL29125_375LX;
+        resolution = data[5] ? ISL29125_12BIT : ISL29125_16BIT;
+        flush_ms = data[6] | (data[7] << 8);
+        encoding = data[8];
+        return true;
+    }
+
+    void encode(uint8_t *value) const {
+        put32(value, period_ms);
+        value[4] = range == ISL29125_10KLX;
+        value[5] = resolution == ISL29125_12BIT;
+        value[6] = flush_ms & 0xFF;
+        value[7] = flush_ms >> 8;
+        value[8] = encoding;
+    }
+
+    bool valid() const {
+        return period_ms >= minPeriod() && period_ms <= CONFIG_MAX_PERIOD_MS &&
+               (range == ISL29125_375LX || range == ISL29125_10KLX) &&
+               (resolution == ISL29125_16BIT || resolution == ISL29125_12BIT) &&
+               flush_ms <= CONFIG_MAX_FLUSH_MS && encoding <= STREAM_ENCODING_PERCEPTUAL;
+    }
+
+    /* shortest period the resolution allows */
+    uint32_t minPeriod() const {
+        return resolution == ISL29125_12BIT ? CONFIG_MIN_PERIOD_12BIT_MS : CONFIG_MIN_PERIOD_16BIT_MS;
+    }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef STATS_PUBLISHER_H
+#define STATS_PUBLISHER_H
+
+#include <mbed.h>
+#include "RGBService.h"
+#include "RunningStats.h"
+#include "SampleHistory.h"
+
+static_assert(MBED_CONF_APP_STATS_WINDOW < MBED_CONF_APP_HISTORY_DEPTH, "the statistics window must fit in the history");
+static_assert(MBED_CONF_APP_STATS_HOP <= MBED_CONF_APP_STATS_WINDOW, "statistics are published at least once per window");
+
+/**
+ * Welford statistics of the last MBED_CONF_APP_STATS_WINDOW samples of the
+ * history, made the value of the statistics characteristic every
+ * MBED_CONF_APP_STATS_HOP samples: one value for every subscriber instead
+ * of a notification per sample. With a hop shorter than the window the
+ * window slides, and is rebuilt from the history once per window length.
+ */
+class StatsPublisher {
+public:
+    StatsPublisher(RGBService &service) :
+        _service(service),
+        _hop(0),
+        _reseed(0)
+    {
+        memset(_value, 0, sizeof(_value));
+    }
+
+    /* take in the newest sample of the history; true when a new value is out, for the caller to notify */
+    bool update(const SampleHistory &history) {
+        const bool sliding = MBED_CONF_APP_STATS_HOP < MBED_CONF_APP_STATS_WINDOW;
+        uint32_t end = history.end();
+        const SampleHistory::sample_t &sample = history.at(end - 1);
+
+        if (sliding && _stats[0].count() == MBED_CONF_APP_STATS_WINDOW) {
+            const SampleHistory::sample_t &leaving = history.at(end - 1 - MBED_CONF_APP_STATS_WINDOW);
+            _stats[0].remove(leaving.r);
+            _stats[1].remove(leaving.g);
+            _stats[2].remove(leaving.b);
+        }
+        _stats[0].add(sample.r);
+        _stats[1].add(sample.g);
+        _stats[2].add(sample.b);
+
+        if (++_hop < MBED_CONF_APP_STATS_HOP) {
+            return false;
+        }
+        _hop = 0;
+        publish(history, end);
+
+        if (!sliding) {
+            for (uint8_t c = 0; c < 3; c++) _stats[c].reset();
+        } else if ((_reseed += MBED_CONF_APP_STATS_HOP) >= MBED_CONF_APP_STATS_WINDOW) {
+            /* start again from the samples in the window before rounding of the mean builds up */
+            _reseed = 0;
+            uint32_t count = _stats[0].count();
+            for (uint8_t c = 0; c < 3; c++) _stats[c].reset();
+            for (uint32_t sequence = end - count; sequence < end; sequence++) {
+                const SampleHistory::sample_t &old = history.at(sequence);
+                _stats[0].add(old.r);
+                _stats[1].add(old.g);
+                _stats[2].add(old.b);
+            }
+        }
+        return true;
+    }
+
+    /* send the last value to a subscriber, in parts if it does not fit in `payload` */
+    void notify(TxScheduler &tx, uint16_t payload) {
+        _service.notifyStats(tx, payload, _value, sizeof(_value));
+    }
+
+    /* the history started over, the window goes with it */
+    void reset() {
+        for (uint8_t c = 0; c < 3; c++) _stats[c].reset();
+        _hop = 0;
+        _reseed = 0;
+    }
+
+private:
+    void publish(const SampleHistory &history, uint32_t end) {
+        uint32_t count = _stats[0].count();
+        SampleHistory::summary_t summary;
+        history.summarize(end - count, end, summary);
+
+        put32(_value, end - 1);
+        _value[4] = count & 0xFF;
+        _value[5] = count >> 8;
+        uint8_t *p = &_value[6];
+        for (uint8_t c = 0; c < 3; c++) {
+            p[0] = summary.min[c] & 0xFF; p[1] = summary.min[c] >> 8;
+            p[2] = summary.max[c] & 0xFF; p[3] = summary.max[c] >> 8;
+            put32(&p[4], _stats[c].mean());
+            put32(&p[8], _stats[c].variance());
+            p += 12;
+        }
+        _service.setStats(_value, sizeof(_value));
+    }
+
+    RGBService &_service;
+    RunningStats _stats[3];     // R, G, B
+    uint16_t _hop;              // samples since the last publication
+    uint16_t _reseed;           // samples since the sliding window statistics were rebuilt
+    uint8_t _value[RGBService::STATS_SIZE];
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef STREAM_FRAME_H
+#define STREAM_FRAME_H
+
+#include <mbed.h>
+#include "ISL29125.h"
+#include "RGBService.h"
+#include "SensorConfig.h"
+#include "PerceptualCode.h"
+#include "Pack12.h"
+
+/* layout byte of a stream frame packed at 12 bit, the other frames carry their encoding */
+#define STREAM_LAYOUT_PACKED12 2
+
+/**
+ * The stream frame a link is filling: the number of its first sample and
+ * its layout, then consecutive samples in that layout. The layout is set
+ * by the first sample and kept until the frame is sent; 12 bit samples are
+ * packed in pairs, the first of a pair held back until the second comes or
+ * the frame goes.
+ */
+class StreamFrame {
+public:
+    StreamFrame() :
+        _len(0),
+        _samples(0),
+        _first(0),
+        _started(0),
+        _layout(STREAM_ENCODING_16BIT)
+    {
+    }
+
+    /* layout of the frames taken with a configuration */
+    static uint8_t layout(const SensorConfig &config) {
+        bool packed = config.encoding == STREAM_ENCODING_16BIT && config.resolution == ISL29125_12BIT;
+        return packed ? STREAM_LAYOUT_PACKED12 : config.encoding;
+    }
+
+    /* bytes a frame of `samples` takes in a layout */
+    static uint16_t size(uint8_t layout, uint16_t samples) {
+        uint16_t size = RGBService::STREAM_HEADER_SIZE;
+        if (layout == STREAM_ENCODING_PERCEPTUAL) {
+            return size + samples * RGBService::STREAM_PERCEPTUAL_SAMPLE_SIZE;
+        }
+        return size + (layout == STREAM_LAYOUT_PACKED12 ? Pack12::size(3 * samples) : samples * RGBService::STREAM_SAMPLE_SIZE);
+    }
+
+    /* samples that fit in a frame of `payload` bytes in a layout */
+    static uint16_t capacity(uint8_t layout, uint16_t payload) {
+        payload -= RGBService::STREAM_HEADER_SIZE;
+        if (layout == STREAM_ENCODING_PERCEPTUAL) {
+            return payload / RGBService::STREAM_PERCEPTUAL_SAMPLE_SIZE;
+        }
+        return layout == STREAM_LAYOUT_PACKED12 ? 2 * payload / 9 : payload / RGBService::STREAM_SAMPLE_SIZE;
+    }
+
+    uint16_t samples() const {
+        return _samples;
+    }
+
+    /* number of the sample that comes next in the frame */
+    uint32_t next() const {
+        return _first + _samples;
+    }
+
+    /* when the first sample went in */
+    uint64_t started() const {
+        return _started;
+    }
+
+    /* one more sample would not fit in `payload` bytes */
+    bool full(uint16_t payload) const {
+        return size(_layout, _samples + 1) > payload;
+    }
+
+    /* encode a sample at the end of the frame, the first one also fills in the header */
+    void append(uint8_t layout, uint32_t sequence, uint64_t now, uint16_t r, uint16_t g, uint16_t b) {
+        if (_samples == 0) {
+            _started = now;
+            _first = sequence;
+            _layout = layout;
+            put32(_frame, sequence);
+            _frame[4] = layout;
+            _len = RGBService::STREAM_HEADER_SIZE;
+        }
+        uint8_t *p = &_frame[_len];
+        if (_layout == STREAM_ENCODING_PERCEPTUAL) {
+            p[0] = PerceptualCode::encode(r);
+            p[1] = PerceptualCode::encode(g);
+            p[2] = PerceptualCode::encode(b);
+            _len += RGBService::STREAM_PERCEPTUAL_SAMPLE_SIZE;
+        } else if (_layout != STREAM_LAYOUT_PACKED12) {
+            p[0] = r & 0xFF; p[1] = r >> 8;
+            p[2] = g & 0xFF; p[3] = g >> 8;
+            p[4] = b & 0xFF; p[5] = b >> 8;
+            _len += RGBService::STREAM_SAMPLE_SIZE;
+        } else if (_samples % 2 == 0) {
+            _odd[0] = r;
+            _odd[1] = g;
+            _odd[2] = b;
+        } else {
+            const uint16_t pair[6] = { _odd[0], _odd[1], _odd[2], r, g, b };
+            _len += Pack12::pack(pair, 6, p);
+        }
+        _samples++;
+    }
+
+    /* queue the frame if it has samples and start over, the number of samples queued is returned */
+    uint16_t send(RGBService &service, TxScheduler &tx) {
+        if (_layout == STREAM_LAYOUT_PACKED12 && _samples % 2) {
+            _len += Pack12::pack(_odd, 3, &_frame[_len]);
+        }
+        uint16_t samples = _samples;
+        if (samples) {
+            service.updateStream(tx, _frame, _len, samples);
+        }
+        clear();
+        return samples;
+    }
+
+    void clear() {
+        _len = 0;
+        _samples = 0;
+    }
+
+private:
+    uint8_t _frame[RGBService::STREAM_MAX_PAYLOAD];
+    uint16_t _len;
+    uint16_t _samples;
+    uint16_t _odd[3];           // first sample of a pair, packed once the second comes
+    uint32_t _first;            // number of the first sample
+    uint64_t _started;
+    uint8_t _layout;
+};
+
+#endif
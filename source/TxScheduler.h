@@ -0,0 +1,305 @@
+#ifndef TX_SCHEDULER_H
+#define TX_SCHEDULER_H
+
+#include <mbed.h>
+#include "ble/BLE.h"
+
+/* largest notification the scheduler queues: ATT_MTU 247 minus the ATT header */
+#define TX_MAX_FRAME 244
+
+class TxScheduler;
+
+/**
+ * TX buffers of the controller. They are one pool for every connection, and
+ * GattServer::onDataSent reports the buffers released without saying for
+ * which connection, so the queues draw their credits from a single pool.
+ * The pool keeps the frames in flight in the order they went to the stack,
+ * with the queue that sent each, and a release gives back the oldest ones:
+ * the controller sends each connection's frames in order, and releases
+ * them in about the order it got them. A connection that closes takes its
+ * frames still in flight out of the pool, wherever they are in that order.
+ *
+ * BLE_ERROR_NO_MEM means the controller has no buffer left, some of them
+ * perhaps taken by traffic that is not a notification of ours, ATT
+ * responses say, whose release is never reported. The pool then holds
+ * every queue back, still counting the frames in flight, until the stack
+ * releases one of them or the application calls unblock(), from a timer it
+ * arms when onBlocked() calls it back: with no frame of ours in flight no
+ * release would ever come.
+ */
+class TxCredits {
+public:
+    TxCredits() :
+        _oldest(0),
+        _in_flight(0),
+        _blocked(false)
+    {
+    }
+
+    /* called each time the pool starts holding the queues back */
+    void onBlocked(mbed::Callback<void()> callback) {
+        _on_blocked = callback;
+    }
+
+    bool available() const {
+        return !_blocked && _in_flight < MBED_CONF_APP_TX_CREDITS;
+    }
+
+    /* a frame of `owner` went to the stack */
+    void take(const TxScheduler *owner) {
+        _owners[(_oldest + _in_flight) % MBED_CONF_APP_TX_CREDITS] = owner;
+        _in_flight++;
+    }
+
+    /* buffers given back by the stack, the oldest frames in flight, never more than it has; the controller has
+     * room again */
+    void release(unsigned count) {
+        if (count == 0) {
+            return;
+        }
+        for (; count > 0 && _in_flight > 0; count--) {
+            _oldest = (_oldest + 1) % MBED_CONF_APP_TX_CREDITS;
+            _in_flight--;
+        }
+        _blocked = false;
+    }
+
+    /* the connection of `owner` closed, and with it went its buffers in the controller */
+    void forget(const TxScheduler *owner) {
+        uint8_t kept = 0;
+        for (uint8_t i = 0; i < _in_flight; i++) {
+            const TxScheduler *sender = _owners[(_oldest + i) % MBED_CONF_APP_TX_CREDITS];
+            if (sender != owner) {
+                _owners[(_oldest + kept++) % MBED_CONF_APP_TX_CREDITS] = sender;
+            }
+        }
+        if (kept < _in_flight) {
+            _in_flight = kept;
+            _blocked = false;
+        }
+    }
+
+    /* the stack answered BLE_ERROR_NO_MEM: it has no buffer left, whatever was counted */
+    void block() {
+        if (!_blocked) {
+            _blocked = true;
+            if (_on_blocked) {
+                _on_blocked();
+            }
+        }
+    }
+
+    /* try the controller again */
+    void unblock() {
+        _blocked = false;
+    }
+
+private:
+    const TxScheduler *_owners[MBED_CONF_APP_TX_CREDITS];  // queue of each frame in flight, oldest first
+    uint8_t _oldest;
+    uint8_t _in_flight;     // frames of every connection the stack has not released yet
+    bool _blocked;          // the last write found the controller full
+    mbed::Callback<void()> _on_blocked;
+};
+
+/**
+ * Notification send queue, one per connection, drawing on the shared TX
+ * credits.
+ *
+ * Every successful GattServer::write() consumes a credit and every buffer
+ * the stack releases (GattServer::onDataSent) gives one back to the pool.
+ * While no credit is left, or the pool holds the queues back after
+ * BLE_ERROR_NO_MEM, frames wait in a small FIFO. When that FIFO is full the
+ * oldest frame is dropped; frames sent with COALESCE instead replace the
+ * pending frame of the same characteristic, since only its latest value
+ * matters. PRIORITY frames wait ahead of every other frame and are the
+ * last to be dropped.
+ *
+ * A frame can say how many items, samples say, it carries; the item
+ * counters then tell how many went to the stack and how many were lost.
+ */
+class TxScheduler {
+public:
+    enum policy_t {
+        DROP_OLDEST,
+        COALESCE,
+        PRIORITY
+    };
+
+    struct stats_t {
+        uint32_t sent;      // frames accepted by the stack
+        uint32_t queued;    // frames that had to wait for a credit
+        uint32_t dropped;   // frames lost to a full queue or a stack error
+        uint32_t coalesced; // pending frames replaced by a newer value
+        uint32_t items_sent;    // items of the frames accepted by the stack
+        uint32_t items_dropped; // items of the frames dropped or replaced
+    };
+
+    TxScheduler() :
+        _server(NULL),
+        _credits(NULL),
+        _connection(0)
+    {
+        reset();
+    }
+
+    /* bind the queue to a new connection with fresh counters */
+    void open(GattServer &server, TxCredits &credits, ble::connection_handle_t connection) {
+        _server = &server;
+        _credits = &credits;
+        _connection = connection;
+        reset();
+    }
+
+    /* the connection is gone, and with it the buffers it had in the controller */
+    void close() {
+        if (_credits) {
+            _credits->forget(this);
+        }
+        reset();
+    }
+
+    /* send a notification now if a TX buffer is free, queue it otherwise */
+    void send(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t len, policy_t policy = DROP_OLDEST,
+              uint16_t items = 0) {
+        if (len > TX_MAX_FRAME) {
+            len = TX_MAX_FRAME;
+        }
+
+        if (_count == 0 && _credits->available()) {
+            ble_error_t error = _server->write(_connection, handle, data, len);
+            if (error == BLE_ERROR_NONE) {
+                _credits->take(this);
+                _stats.sent++;
+                _stats.items_sent += items;
+                return;
+            }
+            if (error != BLE_ERROR_NO_MEM) {
+                _stats.dropped++;
+                _stats.items_dropped += items;
+                return;
+            }
+            _credits->block();
+        }
+
+        if (policy == COALESCE) {
+            for (uint8_t i = 0; i < _count; i++) {
+                frame_t &frame = _queue[(_head + i) % MBED_CONF_APP_TX_QUEUE_DEPTH];
+                if (frame.handle == handle) {
+                    _stats.items_dropped += frame.items;
+                    store(frame, handle, data, len, items);
+                    _stats.coalesced++;
+                    return;
+                }
+            }
+        }
+
+        if (_count == MBED_CONF_APP_TX_QUEUE_DEPTH) {
+            _stats.dropped++;
+            if (_priority == _count && policy != PRIORITY) {
+                _stats.items_dropped += items;
+                return;
+            }
+            /* the oldest frame behind the priority ones goes, the oldest priority frame if they fill the queue */
+            uint8_t drop = _priority < _count ? _priority : 0;
+            _stats.items_dropped += _queue[(_head + drop) % MBED_CONF_APP_TX_QUEUE_DEPTH].items;
+            remove(drop);
+            if (drop < _priority) _priority--;
+        }
+
+        uint8_t position = _count;
+        if (policy == PRIORITY) {
+            /* behind the priority frames already waiting, ahead of the rest */
+            for (uint8_t i = _count; i > _priority; i--) {
+                _queue[(_head + i) % MBED_CONF_APP_TX_QUEUE_DEPTH] = _queue[(_head + i - 1) % MBED_CONF_APP_TX_QUEUE_DEPTH];
+            }
+            position = _priority++;
+        }
+        store(_queue[(_head + position) % MBED_CONF_APP_TX_QUEUE_DEPTH], handle, data, len, items);
+        _count++;
+        _stats.queued++;
+    }
+
+    /* send what waits while the shared credits last */
+    void retry() {
+        pump();
+    }
+
+    /* forget pending frames and counters */
+    void reset() {
+        _head = 0;
+        _count = 0;
+        _priority = 0;
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    uint8_t pending() const {
+        return _count;
+    }
+
+    /* true when a frame sent now goes straight to the stack */
+    bool ready() const {
+        return _count == 0 && _credits->available();
+    }
+
+    const stats_t &stats() const {
+        return _stats;
+    }
+
+private:
+    struct frame_t {
+        GattAttribute::Handle_t handle;
+        uint16_t len;
+        uint16_t items;
+        uint8_t data[TX_MAX_FRAME];
+    };
+
+    void store(frame_t &frame, GattAttribute::Handle_t handle, const uint8_t *data, uint16_t len, uint16_t items) {
+        frame.handle = handle;
+        frame.len = len;
+        frame.items = items;
+        memcpy(frame.data, data, len);
+    }
+
+    /* close the gap left by the frame at queue position `index` */
+    void remove(uint8_t index) {
+        for (uint8_t i = index; i + 1 < _count; i++) {
+            _queue[(_head + i) % MBED_CONF_APP_TX_QUEUE_DEPTH] = _queue[(_head + i + 1) % MBED_CONF_APP_TX_QUEUE_DEPTH];
+        }
+        _count--;
+    }
+
+    /* drain the queue in order while credits last */
+    void pump() {
+        while (_count > 0 && _credits->available()) {
+            frame_t &frame = _queue[_head];
+            ble_error_t error = _server->write(_connection, frame.handle, frame.data, frame.len);
+            if (error == BLE_ERROR_NO_MEM) {
+                _credits->block();
+                return;
+            }
+            if (error == BLE_ERROR_NONE) {
+                _credits->take(this);
+                _stats.sent++;
+                _stats.items_sent += frame.items;
+            } else {
+                _stats.dropped++;
+                _stats.items_dropped += frame.items;
+            }
+            _head = (_head + 1) % MBED_CONF_APP_TX_QUEUE_DEPTH;
+            _count--;
+            if (_priority > 0) _priority--;
+        }
+    }
+
+    GattServer *_server;
+    TxCredits *_credits;
+    ble::connection_handle_t _connection;
+    frame_t _queue[MBED_CONF_APP_TX_QUEUE_DEPTH];
+    uint8_t _head;
+    uint8_t _count;
+    uint8_t _priority;  // frames at the head of the queue sent with PRIORITY
+    stats_t _stats;
+};
+
+#endif
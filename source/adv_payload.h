@@ -0,0 +1,58 @@
+#ifndef ADV_PAYLOAD_H
+#define ADV_PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+/**
+ * Compile time advertising data.
+ *
+ * A payload is a struct of AdvField members, each one an AD structure
+ * (length, AD type, value) made only of bytes, so the struct has no padding
+ * and its size is the size on air. Payloads built from constexpr values are
+ * placed in flash and can be size checked with static_assert.
+ */
+template<size_t N>
+struct AdvField {
+    uint8_t length;     // AD type plus value
+    uint8_t type;
+    uint8_t value[N];
+};
+
+constexpr uint8_t hex_digit(char c) {
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/* position in "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" of hex digit n, skipping the dashes */
+constexpr size_t uuid_char(size_t n) {
+    return n + (n >= 8) + (n >= 12) + (n >= 16) + (n >= 20);
+}
+
+/* byte i of a UUID string, counted from the least significant one as sent on air */
+constexpr uint8_t uuid_byte(const char *uuid, size_t i) {
+    return (hex_digit(uuid[uuid_char(30 - 2 * i)]) << 4) | hex_digit(uuid[uuid_char(31 - 2 * i)]);
+}
+
+template<size_t... I>
+constexpr AdvField<16> make_uuid128_field(uint8_t type, const char *uuid, std::index_sequence<I...>) {
+    return { 17, type, { uuid_byte(uuid, I)... } };
+}
+
+/* AD structure holding one 128-bit UUID */
+constexpr AdvField<16> make_uuid128_field(uint8_t type, const char *uuid) {
+    return make_uuid128_field(type, uuid, std::make_index_sequence<16>());
+}
+
+template<size_t N, size_t... I>
+constexpr AdvField<N - 1> make_name_field(uint8_t type, const char (&name)[N], std::index_sequence<I...>) {
+    return { N, type, { (uint8_t) name[I]... } };
+}
+
+/* AD structure holding a name, without its terminating NUL */
+template<size_t N>
+constexpr AdvField<N - 1> make_name_field(uint8_t type, const char (&name)[N]) {
+    return make_name_field(type, name, std::make_index_sequence<N - 1>());
+}
+
+#endif
@@ -4,66 +4,67 @@
 #include "ble/gap/Gap.h"
 #include "ble/services/BatteryService.h"
 #include "ble/services/DeviceInformationService.h"
+#if DEVICE_FLASH
+#include "FlashIAPBlockDevice.h"
+#include "LittleFileSystem.h"
+#endif
 #include "pretty_printer.h"
 #include "ISL29125.h"
+#include "TxScheduler.h"
+#include "RGBService.h"
+#include "adv_payload.h"
+#include "storage.h"
+#include "GatewayStore.h"
+#include "SampleHistory.h"
+#include "SampleLog.h"
+#include "SampleReader.h"
+#include "HistoryDownload.h"
+#include "ReliableStream.h"
+#include "RollupPublisher.h"
+#include "QueryPublisher.h"
+#include "CounterPublisher.h"
+#include "StatsPublisher.h"
+#include "BurstRecorder.h"
+#include "FlickerMeter.h"
+#include "AdaptiveRate.h"
+#include "EventPublisher.h"
+#include "ScenePublisher.h"
+#include "Calibrator.h"
+#include "SensorConfig.h"
+#include "StreamFrame.h"
+#include "BroadcastSample.h"
 
-// UUID per il servizio RGB
-#define UUID_RGB_SERVICE "12345678-1234-5678-1234-56789abcdef0"
-
-// UUID per le caratteristiche RGB
-#define UUID_RED_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef1"
-#define UUID_GREEN_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef2"
-#define UUID_BLUE_CHARACTERISTIC "12345678-1234-5678-1234-56789abcdef3"
-
-UUID uuid_list[] = { UUID_RGB_SERVICE,
-    UUID_RED_CHARACTERISTIC,
-    UUID_GREEN_CHARACTERISTIC,
-    UUID_BLUE_CHARACTERISTIC
-    };
-
-class RGBService {
-public:
-    typedef uint16_t RGBType_t;
+/* device name */
+constexpr static char DEVICE_NAME[] = "RGBSensor";
 
-    RGBService(BLE& _ble) :
-        ble(_ble),
-        redCharacteristic(UUID_RED_CHARACTERISTIC, &red, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
-        greenCharacteristic(UUID_GREEN_CHARACTERISTIC, &green, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
-        blueCharacteristic(UUID_BLUE_CHARACTERISTIC, &blue, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY)
-    {
-        GattCharacteristic *charTable[] = { &redCharacteristic, &greenCharacteristic, &blueCharacteristic };
-        GattService rgbService(UUID_RGB_SERVICE, charTable, sizeof(charTable) / sizeof(GattCharacteristic *));
-        ble.gattServer().addService(rgbService);
-    }
+/* AD flags: general discoverable, BR/EDR not supported */
+constexpr AdvField<1> adv_flags = {
+    2, ble::adv_data_type_t::FLAGS,
+    { ble::adv_data_flags_t::LE_GENERAL_DISCOVERABLE | ble::adv_data_flags_t::BREDR_NOT_SUPPORTED }
+};
 
-    void updateRed(RGBType_t newRedVal) {
-        red = newRedVal;
-        ble.gattServer().write(redCharacteristic.getValueHandle(), (uint8_t *) &red, sizeof(RGBType_t));
-    }
+/* advertising data: flags and the RGB service UUID, enough for centrals to filter on it */
+struct AdvertisingPayload {
+    AdvField<1> flags;
+    AdvField<16> service;
+};
 
-    void updateGreen(RGBType_t newGreenVal) {
-        green = newGreenVal;
-        ble.gattServer().write(greenCharacteristic.getValueHandle(), (uint8_t *) &green, sizeof(RGBType_t));
-    }
+constexpr AdvertisingPayload adv_payload = {
+    adv_flags,
+    make_uuid128_field(ble::adv_data_type_t::COMPLETE_LIST_128BIT_SERVICE_IDS, UUID_RGB_SERVICE)
+};
 
-    void updateBlue(RGBType_t newBlueVal) {
-        blue = newBlueVal;
-        ble.gattServer().write(blueCharacteristic.getValueHandle(), (uint8_t *) &blue, sizeof(RGBType_t));
-    }
+/* scan response: the device name */
+struct ScanResponsePayload {
+    AdvField<sizeof(DEVICE_NAME) - 1> name;
+};
 
-private:
-    BLE& ble;
-    RGBType_t red;
-    RGBType_t green;
-    RGBType_t blue;
-
-    ReadOnlyGattCharacteristic<RGBType_t> redCharacteristic;
-    ReadOnlyGattCharacteristic<RGBType_t> greenCharacteristic;
-    ReadOnlyGattCharacteristic<RGBType_t> blueCharacteristic;
+constexpr ScanResponsePayload scan_response_payload = {
+    make_name_field(ble::adv_data_type_t::COMPLETE_LOCAL_NAME, DEVICE_NAME)
 };
 
-/* device name */
-const static char DEVICE_NAME[] = "RGBSensor";
+static_assert(sizeof(AdvertisingPayload) <= ble::LEGACY_ADVERTISING_MAX_SIZE, "advertising data exceeds 31 bytes");
+static_assert(sizeof(ScanResponsePayload) <= ble::LEGACY_ADVERTISING_MAX_SIZE, "scan response exceeds 31 bytes");
 
 
 ISL29125 RGBsensor(D14, D15);
@@ -71,21 +72,57 @@ ISL29125 RGBsensor(D14, D15);
 uint16_t GRBdata[3];
 bool data_present;
 
-/* Advertising data buffer */
-uint8_t adv_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
+/* broadcast mode: company identifier reserved by the Bluetooth SIG for tests */
+#define BROADCAST_COMPANY_ID 0xFFFF
+
+/* broadcast mode advertising data: flags, name and the latest sample as manufacturer
+ * specific data, the company id then a BroadcastSample */
+struct BroadcastPayload {
+    AdvField<1> flags;
+    AdvField<sizeof(DEVICE_NAME) - 1> name;
+    AdvField<2 + BroadcastSample::SIZE> data;
+};
+
+static_assert(sizeof(BroadcastPayload) <= ble::LEGACY_ADVERTISING_MAX_SIZE, "broadcast data exceeds 31 bytes");
+
+/* only the sample bytes of data.value change, the rest is laid out at compile time */
+BroadcastPayload broadcast_payload = {
+    adv_flags,
+    make_name_field(ble::adv_data_type_t::COMPLETE_LOCAL_NAME, DEVICE_NAME),
+    { 3 + BroadcastSample::SIZE, ble::adv_data_type_t::MANUFACTURER_SPECIFIC_DATA,
+      { BROADCAST_COMPANY_ID & 0xFF, BROADCAST_COMPANY_ID >> 8 } }
+};
+
+ble_error_t set_broadcast_payload(BLE &ble, const uint8_t *sample) {
+    memcpy(&broadcast_payload.data.value[2], sample, BroadcastSample::SIZE);
+
+    return ble.gap().setAdvertisingPayload(
+        ble::LEGACY_ADVERTISING_HANDLE,
+        mbed::make_const_Span((const uint8_t *) &broadcast_payload, sizeof(broadcast_payload))
+    );
+}
+
+/* events that can wait in the queue at once: the stream and history flush timers of every link, the advertising
+ * back-off, a flash log step, a fast sample, the burst timeout, a flicker step, a query step, the retransmission
+ * check, the TX retry, and BLE processing, which the stack may ask for again before it runs */
+#define QUEUE_EVENT_COUNT (2 * MBED_CONF_APP_MAX_CONNECTIONS + 10)
+/* EVENTS_EVENT_SIZE holds a plain callback, a member call with a link index takes a little more */
+#define QUEUE_EVENT_SIZE (EVENTS_EVENT_SIZE + 2 * sizeof(void *))
 
 /* BLE event queue */
-static events::EventQueue event_queue(/* event count */ 16 * EVENTS_EVENT_SIZE);
+static events::EventQueue event_queue(QUEUE_EVENT_COUNT * QUEUE_EVENT_SIZE);
 
 bool initFlag = false;
 
 Ticker updateSensors;
 
-// Declare and define a measurement update flag
-bool sensorFlag = false;
+// Declare and define a measurement update flag, set from the ticker interrupt
+volatile bool sensorFlag = false;
 
 void updateMeasurments(){
     sensorFlag = true;
+    /* wake the main loop now rather than at the end of its dispatch slice */
+    event_queue.break_dispatch();
 }
 
 void on_init_complete(BLE::InitializationCompleteCallbackContext *params) {
@@ -97,60 +134,1388 @@ void on_init_complete(BLE::InitializationCompleteCallbackContext *params) {
     initFlag = true;
 }
 
-class RGBApp : ble::Gap::EventHandler {
+void start_advertising(BLE &ble, uint32_t interval_ms);
+ble_error_t start_directed_advertising(BLE &ble, const ble::address_t &peer, ble::target_peer_address_type_t peer_type);
+
+/* flash from the top down: the KVStore, the bond database, the sample log */
+#define BOND_DATABASE "/bonds/ble.db"
+/* sectors at the end of internal flash mbed gives TDB_INTERNAL when mbed_app.json leaves its range unset */
+#define STORAGE_DEFAULT_SECTORS 2
+/* the sensor converts a single channel every 6.25 ms at 12 bit, poll it a few times as often */
+#define FAST_POLL_US 2000
+/* flash log samples a range query reads per event, a couple of blocks */
+#define QUERY_STEP_SAMPLES 64
+/* after BLE_ERROR_NO_MEM, how long the links wait to try the controller again if none of their frames is released first */
+#define TX_RETRY_MS 50
+
+#if !DEVICE_FLASH
+static_assert(MBED_CONF_APP_FLASH_LOG_SECTORS == 0, "the flash log needs FlashIAP, set app.flash-log-sectors to 0 for this target");
+static_assert(MBED_CONF_APP_BOND_STORE_SIZE == 0, "the bond store needs FlashIAP, set app.bond-store-size to 0 for this target");
+#endif
+
+class RGBApp : ble::Gap::EventHandler, GattServer::EventHandler, SecurityManager::EventHandler {
 public:
     RGBApp(BLE &ble, events::EventQueue &event_queue) :
         _ble(ble),
         _event_queue(event_queue),
-        _connected(false),
-        _rgbService(ble)
-        {}
+        _rgbService(ble),
+        _tx_turn(0),
+        _tx_retry_event(0),
+        _slow_adv_event(0),
+        _adv_fast_since(0),
+        _directed(false),
+#if DEVICE_FLASH
+        _bond_device(storageBase() - MBED_CONF_APP_BOND_STORE_SIZE, MBED_CONF_APP_BOND_STORE_SIZE),
+        _bond_fs("bonds"),
+#endif
+        _log(_flash),
+        _reader(_history, _log),
+        _downloads(_rgbService, _history, _reader),
+        _reliable(_rgbService, _history, _reader),
+        _log_event(0),
+        _sequence_reserved(0),
+        _rollups(_rgbService),
+        _fast_channel(0),
+        _fast_pending(false),
+        _burst(_rgbService, _event_queue),
+        _flicker(_rgbService, _event_queue),
+        _stats(_rgbService),
+        _events(_rgbService),
+        _scenes(_rgbService),
+        _calibrator(_rgbService, RGBsensor),
+        _config(SensorConfig::defaults()),
+        _config_pending(false),
+        _period_ms(0),
+        _counters(_rgbService),
+        _reliable_event(0),
+        _queries(_rgbService, _history, _log),
+        _query_event(0)
+        {
+            memset(&_reconnect, 0, sizeof(_reconnect));
+            for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+                _links[i].connected = false;
+            }
+            _tx_credits.onBlocked(callback(this, &RGBApp::txBlocked));
+            _flicker.onResult(callback(this, &RGBApp::flickerResult));
+            _ble.gattServer().onDataSent(this, &RGBApp::onDataSent);
+            _ble.gattServer().onDataWritten(this, &RGBApp::onDataWritten);
+            _rgbService.setConfigAuthorization(this, &RGBApp::authorizeConfig);
+            _rgbService.setSceneModelAuthorization(this, &RGBApp::authorizeSceneModel);
+            _rgbService.setCalibrationAuthorization(this, &RGBApp::authorizeCalibration);
+            _ble.gattServer().onUpdatesEnabled(makeFunctionPointer(this, &RGBApp::onUpdatesChanged));
+            _ble.gattServer().onUpdatesDisabled(makeFunctionPointer(this, &RGBApp::onUpdatesChanged));
+        }
     
 
+    /* start advertising once BLE is initialized */
+    void start() {
+        uint32_t floor, end;
+        if (_flash.init() == 0 && logRegion(floor, end) && _log.init(floor, end, MBED_CONF_APP_FLASH_LOG_SECTORS) == 0) {
+            printf("Flash log resumes at sample %lu, recovered in %lu reads\r\n",
+                   (unsigned long) _log.end(), (unsigned long) _log.stats().reads);
+        } else if (MBED_CONF_APP_FLASH_LOG_SECTORS == 0) {
+            printf("Flash log off for this target (app.flash-log-sectors), numbering kept in KVStore\r\n");
+        } else {
+            printf("Flash log unavailable\r\n");
+        }
+        /* without a log, numbering resumes past what the last boot reserved */
+        uint32_t first = _log.end();
+        if (!_log.ready()) {
+            storage_load(STORAGE_KEY("sequence"), first);
+            _sequence_reserved = first;
+            reserveSequence(first);
+        }
+        _history.restart(first);
+
+        /* boot straight into the configuration a client chose last */
+        SensorConfig config;
+        if (storage_load(STORAGE_KEY("config"), config) && config.valid()) {
+            _config = config;
+        }
+        applyConfig();
+
+        _calibrator.start();
+
+        _scenes.start();
+
+#if MBED_CONF_APP_BROADCAST_MODE
+        start_advertising(_ble, MBED_CONF_APP_BROADCAST_INTERVAL_MS);
+#else
+        /* bond with centrals so a known gateway can reconnect without pairing again */
+        const char *db = bondDatabase();
+        ble_error_t error = _ble.securityManager().init(
+            /* bonding */ true, /* MITM */ false, SecurityManager::IO_CAPS_NONE,
+            /* passkey */ NULL, /* signing */ false, /* security db */ db
+        );
+        if (error) {
+            print_error(error, "SecurityManager::init failed");
+        } else {
+            _ble.securityManager().preserveBondingStateOnReset(db != NULL);
+            _ble.securityManager().setSecurityManagerEventHandler(this);
+        }
+
+        /* with the keys gone the gateway has to pair again, calling it back is no use */
+        if (db && !error) {
+            _gateway.load(_history.begin());
+        }
+        _adv_fast_since = Kernel::get_ms_count();
+        callBack();
+#endif
+    }
+
+    /* read the sensor once, keep the sample in the history and fan it out to every subscribed central */
     void updateRGB() {
-        if (_connected) {
-            data_present = RGBsensor.Read(ISL29125_RGB, GRBdata);
-            if(data_present) printf("R: %i, G: %i, B: %i\r\n", GRBdata[1], GRBdata[0], GRBdata[2]);
-            _rgbService.updateRed(GRBdata[1]);
-            _rgbService.updateGreen(GRBdata[0]);
-            _rgbService.updateBlue(GRBdata[2]);
+        /* the sensor converts a single channel for a burst capture, live samples wait for it to end */
+        if (_fast_channel) {
+            return;
+        }
+
+        data_present = RGBsensor.Read(ISL29125_RGB, GRBdata);
+        if(data_present) {
+#if MBED_CONF_APP_SAMPLE_TRACE
+            /* a blocking write of the whole line, longer than a fast sampling period at 9600 baud */
+            printf("R: %i, G: %i, B: %i\r\n", GRBdata[1], GRBdata[0], GRBdata[2]);
+#endif
+            _counters.acquired();
+            uint64_t now = Kernel::get_ms_count();
+            uint64_t time = _log.time(now);
+            _history.push((uint32_t) time, GRBdata[1], GRBdata[0], GRBdata[2]);
+            reserveSequence(_history.end());
+            _log.append(now, GRBdata[1], GRBdata[0], GRBdata[2]);
+            _rollups.add(time, GRBdata[1], GRBdata[0], GRBdata[2]);
+            if (_stats.update(_history)) {
+                notifySubscribers(RGBService::STATS_SUBSCRIBED, _stats);
+            }
+            if (_events.update((uint32_t) time, GRBdata[1], GRBdata[0], GRBdata[2])) {
+                notifySubscribers(RGBService::EVENT_SUBSCRIBED, _events);
+            }
+            if (_scenes.update(GRBdata[1], GRBdata[0], GRBdata[2])) {
+                notifySubscribers(RGBService::SCENE_SUBSCRIBED, _scenes);
+            }
+            _calibrator.update(GRBdata[1], GRBdata[0], GRBdata[2]);
+            scheduleLog();
+
+            uint32_t period = _rate.update(GRBdata[1], GRBdata[0], GRBdata[2]);
+            if (period != _period_ms) {
+                _period_ms = period;
+                updateSensors.attach_us(&updateMeasurments, _period_ms * 1000);
+            }
+        } else {
+            _counters.missed();
+        }
+
+#if MBED_CONF_APP_BROADCAST_MODE
+        /* a read without a new conversion leaves the payload as it is, scanners count each new one */
+        if (data_present) {
+            updateBroadcast(GRBdata[1], GRBdata[0], GRBdata[2]);
+        }
+#endif
+
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            Link &link = _links[i];
+            if (!link.connected) continue;
+            if (link.subscriptions & RGBService::RED_SUBSCRIBED) _rgbService.updateRed(link.tx, GRBdata[1]);
+            if (link.subscriptions & RGBService::GREEN_SUBSCRIBED) _rgbService.updateGreen(link.tx, GRBdata[0]);
+            if (link.subscriptions & RGBService::BLUE_SUBSCRIBED) _rgbService.updateBlue(link.tx, GRBdata[2]);
+            if (data_present && (link.subscriptions & RGBService::XYZ_SUBSCRIBED)) _calibrator.notify(link.tx, notifyPayload(link));
+            /* a central catching up on the history gets the link to itself, a reliable stream goes in pump() */
+            if (data_present && !link.reliable.enabled && (link.subscriptions & RGBService::STREAM_SUBSCRIBED)) {
+                if (link.download.backlog) {
+                    link.counters.suppressed++;
+                } else {
+                    batchSample(link, _history.end() - 1, GRBdata[1], GRBdata[0], GRBdata[2]);
+                }
+            }
+            pump(link);
+        }
+
+        /* a new configuration takes effect at the sample boundary, all of it at once */
+        if (_config_pending) {
+            _config_pending = false;
+            /* no stream frame mixes two encodings */
+            if (_next_config.encoding != _config.encoding || _next_config.resolution != _config.resolution) {
+                for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+                    if (_links[i].connected) flushStream(_links[i]);
+                }
+            }
+            _config = _next_config;
+            applyConfig();
+            storage_save(STORAGE_KEY("config"), _config);
         }
     }
 
 private:
-    void onDisconnectionComplete(const ble::DisconnectionCompleteEvent&) {
-        _ble.gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
-        _connected = false;
+#if MBED_CONF_APP_BROADCAST_MODE
+    /* refresh the advertising payload with the sample just acquired */
+    void updateBroadcast(uint16_t r, uint16_t g, uint16_t b) {
+        uint8_t sample[BroadcastSample::SIZE];
+        _broadcast.encode(_config, (uint16_t) (_history.end() - 1), r, g, b, sample);
+        ble_error_t error = set_broadcast_payload(_ble, sample);
+        if (error) {
+            print_error(error, "Gap::setAdvertisingPayload failed");
+        }
+    }
+#endif
+
+    /* state kept for each connected central */
+    struct Link {
+        bool connected;
+        ble::connection_handle_t handle;
+        uint8_t peer[6];
+        uint8_t peer_type;
+        bool gateway;
+        bool bonded;            // identity known from the bond, see peerIdentity()
+        uint8_t identity[6];    // identity address, the gateway is kept under it
+        uint8_t identity_type;
+        bool encrypted;
+        uint16_t subscriptions;
+        uint16_t att_mtu;
+        uint16_t tx_octets;
+        ble::phy_t tx_phy;
+        TxScheduler tx;
+
+        StreamFrame batch;
+        int stream_flush_event; // sends the partial stream frame once its oldest sample is due
+        CounterPublisher::counts_t counters;
+
+        ReliableStream::state_t reliable;
+
+        HistoryDownload::download_t download;
+        SampleReader::cursor_t cursor;
+        int history_flush_event;    // sends the partial history frame once its oldest sample is due
+
+        RollupPublisher::request_t rollup;
+
+        uint16_t burst_next;    // next capture sample to send, BurstRecorder::INFO or IDLE
+
+        QueryPublisher::query_t query;
+    };
+
+    void onDisconnectionComplete(const ble::DisconnectionCompleteEvent &event) {
+        Link *link = findLink(event.getConnectionHandle());
+        if (link) {
+            const TxScheduler::stats_t &stats = link->tx.stats();
+            printf("TX - sent: %lu, queued: %lu, dropped: %lu, coalesced: %lu\r\n",
+                   (unsigned long) stats.sent, (unsigned long) stats.queued,
+                   (unsigned long) stats.dropped, (unsigned long) stats.coalesced);
+            printf("Stream - suppressed: %lu, queued: %lu, dropped: %lu, delivered: %lu samples\r\n",
+                   (unsigned long) link->counters.suppressed, (unsigned long) link->counters.queued,
+                   (unsigned long) stats.items_dropped, (unsigned long) stats.items_sent);
+            link->connected = false;
+            link->tx.close();
+            cancelFlush(link->stream_flush_event);
+            cancelFlush(link->history_flush_event);
+            if (link->gateway && (link->subscriptions & RGBService::HISTORY_SUBSCRIBED)) {
+                _gateway.left(HistoryDownload::resumes(link->download));
+            }
+        }
+
+        /* the central that dropped is likely to come back soon */
+        _adv_fast_since = Kernel::get_ms_count();
+        if (link && link->gateway) {
+            callBack();
+        } else {
+            advertiseFast();
+        }
+    }
+
+    /* high duty cycle directed advertising ended without the gateway answering */
+    void onAdvertisingEnd(const ble::AdvertisingEndEvent &event) {
+        if (_directed && !event.isConnected()) {
+            _directed = false;
+            advertiseFast();
+        }
     }
 
     void onConnectionComplete(const ble::ConnectionCompleteEvent &event) {
-        if (event.getStatus() == BLE_ERROR_NONE) {
-            _connected = true;
+        if (event.getStatus() != BLE_ERROR_NONE) {
+            return;
+        }
+
+        Link *link = findLink(event.getConnectionHandle(), /* free slot */ true);
+        if (!link) {
+            _ble.gap().disconnect(event.getConnectionHandle(), ble::local_disconnection_reason_t::LOW_RESOURCES);
+            return;
+        }
+
+        _directed = false;
+        link->connected = true;
+        link->handle = event.getConnectionHandle();
+        memcpy(link->peer, event.getPeerAddress().data(), sizeof(link->peer));
+        link->peer_type = isPublic(event.getPeerAddressType()) ?
+            ble::target_peer_address_type_t::PUBLIC : ble::target_peer_address_type_t::RANDOM;
+        /* a central on a private address is recognised once it encrypts the link, see peerIdentity() */
+        link->gateway = _gateway.is(link->peer);
+        link->bonded = false;
+        link->encrypted = false;
+        link->att_mtu = DEFAULT_ATT_MTU;
+        link->tx_octets = DEFAULT_LL_OCTETS;
+        link->tx_phy = ble::phy_t::LE_1M;
+        link->batch.clear();
+        link->stream_flush_event = 0;
+        link->history_flush_event = 0;
+        CounterPublisher::reset(link->counters);
+        link->reliable.enabled = false;
+        link->download.backlog = false;
+        link->rollup.pending = false;
+        link->burst_next = BurstRecorder::IDLE;
+        link->query.busy = false;
+        link->tx.open(_ble.gattServer(), _tx_credits, link->handle);
+        /* a bonded gateway keeps its CCCDs, stream to it without waiting for it to subscribe again */
+        link->subscriptions = 0;
+        refreshSubscriptions(*link);
+        requestFastPhy(link->handle);
+
+        printf("Central connected, %u of %u slots in use\r\n", connectedCount(), MBED_CONF_APP_MAX_CONNECTIONS);
+        recordReconnect();
+
+        /* the controller stops advertising on connection, keep it going at the slow rate while slots are free */
+        _event_queue.cancel(_slow_adv_event);
+        _slow_adv_event = 0;
+        if (connectedCount() < MBED_CONF_APP_MAX_CONNECTIONS) {
+            start_advertising(_ble, MBED_CONF_APP_ADV_SLOW_INTERVAL_MS);
+        }
+    }
+
+    /* call the bonded gateway back with directed advertising, fall back to fast undirected advertising */
+    void callBack() {
+        if (!_gateway.known()) {
+            advertiseFast();
+            return;
+        }
+        _event_queue.cancel(_slow_adv_event);
+        _slow_adv_event = 0;
+        ble_error_t error = start_directed_advertising(
+            _ble, ble::address_t(_gateway.record().address),
+            ble::target_peer_address_type_t((ble::target_peer_address_type_t::type) _gateway.record().address_type)
+        );
+        _directed = (error == BLE_ERROR_NONE);
+        if (!_directed) {
+            advertiseFast();
+        }
+    }
+
+    /* advertise at the fast interval for a while after boot or a link drop, then back off */
+    void advertiseFast() {
+        _event_queue.cancel(_slow_adv_event);
+        start_advertising(_ble, MBED_CONF_APP_ADV_FAST_INTERVAL_MS);
+        if (_adv_fast_since == 0) {
+            _adv_fast_since = Kernel::get_ms_count();
+        }
+        _slow_adv_event = _event_queue.call_in(MBED_CONF_APP_ADV_FAST_WINDOW_MS, this, &RGBApp::advertiseSlow);
+    }
+
+    void advertiseSlow() {
+        _slow_adv_event = 0;
+        if (connectedCount() < MBED_CONF_APP_MAX_CONNECTIONS) {
+            start_advertising(_ble, MBED_CONF_APP_ADV_SLOW_INTERVAL_MS);
+        }
+    }
+
+    /* time from the start of fast advertising to the next connection */
+    void recordReconnect() {
+        if (_adv_fast_since == 0) {
+            return;
+        }
+        uint32_t elapsed = Kernel::get_ms_count() - _adv_fast_since;
+        _adv_fast_since = 0;
+
+        _reconnect.last_ms = elapsed;
+        _reconnect.total_ms += elapsed;
+        if (_reconnect.count == 0 || elapsed < _reconnect.min_ms) _reconnect.min_ms = elapsed;
+        if (elapsed > _reconnect.max_ms) _reconnect.max_ms = elapsed;
+        if (elapsed >= MBED_CONF_APP_ADV_FAST_WINDOW_MS) _reconnect.slow++;
+        _reconnect.count++;
+
+        printf("Reconnect after %lu ms - min: %lu, max: %lu, mean: %lu ms, %lu of %lu in slow advertising\r\n",
+               (unsigned long) elapsed, (unsigned long) _reconnect.min_ms, (unsigned long) _reconnect.max_ms,
+               (unsigned long) (_reconnect.total_ms / _reconnect.count),
+               (unsigned long) _reconnect.slow, (unsigned long) _reconnect.count);
+    }
+
+    /* notifications left the controller, on whichever connections: the pool takes their buffers back */
+    void onDataSent(unsigned count) {
+        _tx_credits.release(count);
+        serveLinks();
+    }
+
+    /* the controller is full with no release of ours to wait for, maybe, so try it again in a while */
+    void txBlocked() {
+        if (_tx_retry_event == 0) {
+            _tx_retry_event = _event_queue.call_in(TX_RETRY_MS, this, &RGBApp::txRetry);
+        }
+        /* a full event queue leaves the pool open, the next frame sent tries the controller itself */
+        if (_tx_retry_event == 0) {
+            _tx_credits.unblock();
+        }
+    }
+
+    void txRetry() {
+        _tx_retry_event = 0;
+        _tx_credits.unblock();
+        serveLinks();
+    }
+
+    /* hand the TX buffers to what waits on each link, the links taking turns to be first */
+    void serveLinks() {
+        _tx_turn = (_tx_turn + 1) % MBED_CONF_APP_MAX_CONNECTIONS;
+        for (uint8_t k = 0; k < MBED_CONF_APP_MAX_CONNECTIONS; k++) {
+            Link &link = _links[(_tx_turn + k) % MBED_CONF_APP_MAX_CONNECTIONS];
+            if (!link.connected) continue;
+            link.tx.retry();
+            pump(link);
+        }
+    }
+
+    /* a CCCD changed on some connection, the callback does not say which: refresh what each central listens to */
+    void onUpdatesChanged(GattAttribute::Handle_t) {
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            Link &link = _links[i];
+            if (!link.connected) continue;
+            refreshSubscriptions(link);
+
+            if (link.gateway) {
+                _gateway.subscribed(link.subscriptions);
+            }
+        }
+    }
+
+    /* the gateway encrypts with the keys it has, pairing again under its address could be someone posing as it */
+    void pairingRequest(ble::connection_handle_t connectionHandle) {
+        Link *link = findLink(connectionHandle);
+        if (link && link->gateway && !claimWindow()) {
+            printf("Pairing refused, the gateway is bonded already\r\n");
+            _ble.securityManager().cancelPairingRequest(connectionHandle);
+            return;
+        }
+        _ble.securityManager().acceptPairingRequest(connectionHandle);
+    }
+
+    /* a new bond may claim the gateway role, see claimGateway() */
+    void pairingResult(ble::connection_handle_t connectionHandle, SecurityManager::SecurityCompletionStatus_t result) {
+        if (findLink(connectionHandle) && result == SecurityManager::SEC_STATUS_SUCCESS) {
+            _ble.securityManager().getPeerIdentity(connectionHandle);
+        }
+    }
+
+    /**
+     * Identity of a bonded central, after pairing or once it encrypts a new
+     * link. The connection address of a central using privacy changes every
+     * few minutes, so the gateway is kept and recognised by this one; a
+     * central that sent no identity keeps its connection address for good.
+     */
+    void peerIdentity(ble::connection_handle_t connectionHandle, const SecurityManager::address_t *address, bool address_is_public) {
+        Link *link = findLink(connectionHandle);
+        if (!link) {
+            return;
+        }
+        const uint8_t *identity = address ? address->data() : link->peer;
+        uint8_t identity_type = link->peer_type;
+        if (address) {
+            identity_type = address_is_public ? ble::target_peer_address_type_t::PUBLIC : ble::target_peer_address_type_t::RANDOM;
+        }
+
+        memcpy(link->identity, identity, sizeof(link->identity));
+        link->identity_type = identity_type;
+        link->bonded = true;
+        if (!link->gateway && _gateway.is(identity)) {
+            link->gateway = true;
+            /* it was taken for another central when its CCCDs came back, skip what it already received */
+            if ((link->subscriptions & RGBService::HISTORY_SUBSCRIBED) && link->download.end == HistoryDownload::LIVE &&
+                (int32_t) (_gateway.record().next - link->download.next) > 0) {
+                link->download.next = _gateway.record().next;
+            }
+            printf("Gateway reconnected from a private address\r\n");
+        }
+    }
+
+    /**
+     * A bonded central asks to be the gateway: the one called back after a
+     * drop, and the only one whose calibration, scene model and configuration
+     * writes are taken. Granted while there is no gateway, or for the first
+     * gateway-claim-window-ms after a reset, so replacing a gateway takes
+     * hands on the node; pairing alone, Just Works, proves nothing.
+     */
+    void claimGateway(Link &link) {
+        if (!link.encrypted || !link.bonded) {
+            printf("Gateway claim refused, the central is not bonded\r\n");
+            return;
+        }
+        if (link.gateway) {
+            return;
+        }
+        if (_gateway.known() && !claimWindow()) {
+            printf("Gateway claim refused, a gateway is bonded already\r\n");
+            return;
+        }
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            _links[i].gateway = false;
+        }
+        link.gateway = true;
+        /* it takes the history up from where it is, not from where the gateway it replaces left off */
+        uint32_t next = (link.subscriptions & RGBService::HISTORY_SUBSCRIBED) ?
+            HistoryDownload::resumes(link.download) : _history.begin();
+        _gateway.claim(link.identity, link.identity_type, link.subscriptions, next);
+        printf("Bonded with gateway ");
+        print_address(_gateway.record().address);
+    }
+
+    /* the gateway gives its role up, a factory station once it has calibrated the node, say */
+    void releaseGateway(Link &link) {
+        if (!link.gateway || !link.encrypted) {
+            return;
+        }
+        link.gateway = false;
+        _gateway.release();
+        printf("Gateway released\r\n");
+    }
+
+    bool claimWindow() const {
+        return Kernel::get_ms_count() < MBED_CONF_APP_GATEWAY_CLAIM_WINDOW_MS;
+    }
+
+    /* CCCDs of a bonded central are restored once the link is encrypted */
+    void linkEncryptionResult(ble::connection_handle_t connectionHandle, ble::link_encryption_t result) {
+        Link *link = findLink(connectionHandle);
+        if (link) {
+            link->encrypted = result != ble::link_encryption_t::NOT_ENCRYPTED &&
+                              result != ble::link_encryption_t::ENCRYPTION_IN_PROGRESS;
+        }
+        if (!link || result == ble::link_encryption_t::NOT_ENCRYPTED) {
+            return;
+        }
+        if (!link->bonded) {
+            _ble.securityManager().getPeerIdentity(connectionHandle);
+        }
+        refreshSubscriptions(*link);
+        if (link->gateway && link->subscriptions != _gateway.record().subscriptions) {
+            printf("Gateway subscriptions not restored (0x%04x, expected 0x%04x)\r\n",
+                   link->subscriptions, _gateway.record().subscriptions);
+        }
+    }
+
+    static bool isPublic(ble::peer_address_type_t type) {
+        return type == ble::peer_address_type_t::PUBLIC || type == ble::peer_address_type_t::PUBLIC_IDENTITY;
+    }
+
+    void onPhyUpdateComplete(ble_error_t status, ble::connection_handle_t connectionHandle, ble::phy_t txPhy, ble::phy_t rxPhy) {
+        if (status != BLE_ERROR_NONE) {
+            print_error(status, "PHY update failed");
+            return;
+        }
+        Link *link = findLink(connectionHandle);
+        if (link) link->tx_phy = txPhy;
+        printf("PHY updated - TX: %s, RX: %s\r\n", phy_to_string(txPhy), phy_to_string(rxPhy));
+    }
+
+    void onDataLengthChange(ble::connection_handle_t connectionHandle, uint16_t txNumberOfBytes, uint16_t rxNumberOfBytes) {
+        Link *link = findLink(connectionHandle);
+        if (!link) return;
+        link->tx_octets = txNumberOfBytes;
+        printf("Data length - TX: %u, RX: %u bytes, %u samples per frame\r\n",
+               txNumberOfBytes, rxNumberOfBytes, streamFrameSamples(streamPayload(*link)));
+    }
+
+    void onAttMtuChange(ble::connection_handle_t connectionHandle, uint16_t attMtuSize) {
+        Link *link = findLink(connectionHandle);
+        if (!link) return;
+        link->att_mtu = attMtuSize;
+        printf("ATT_MTU: %u bytes, %u samples per frame\r\n",
+               attMtuSize, streamFrameSamples(streamPayload(*link)));
+    }
+
+    /* ask the central to move this link to LE 2M, it stays on LE 1M if either side refuses */
+    void requestFastPhy(ble::connection_handle_t connectionHandle) {
+        if (!_ble.gap().isFeatureSupported(ble::controller_supported_features_t::LE_2M_PHY)) {
+            return;
+        }
+        ble::phy_set_t phys(/* 1M */ false, /* 2M */ true, /* coded */ false);
+        ble_error_t error = _ble.gap().setPhy(connectionHandle, &phys, &phys, ble::coded_symbol_per_bit_t::UNDEFINED);
+        if (error) {
+            print_error(error, "Gap::setPhy failed");
+        }
+    }
+
+    /* longest notification the central takes, whatever the link layer packets */
+    static uint16_t notifyPayload(const Link &link) {
+        return link.att_mtu - ATT_HEADER_SIZE;
+    }
+
+    /* notification payload that fits in one link layer packet with the negotiated MTU and data length */
+    static uint16_t streamPayload(const Link &link) {
+        uint16_t payload = link.att_mtu - ATT_HEADER_SIZE;
+        uint16_t ll_payload = link.tx_octets - L2CAP_HEADER_SIZE - ATT_HEADER_SIZE;
+        if (ll_payload < payload) payload = ll_payload;
+        if (payload > RGBService::STREAM_MAX_PAYLOAD) payload = RGBService::STREAM_MAX_PAYLOAD;
+        return payload;
+    }
+
+    uint8_t streamLayout() const {
+        return StreamFrame::layout(_config);
+    }
+
+    /* samples that fit in a stream frame of `payload` bytes with the configured encoding */
+    uint16_t streamFrameSamples(uint16_t payload) const {
+        return StreamFrame::capacity(streamLayout(), payload);
+    }
+
+    /* add a sample to the stream frame, sent when the next one would not fit or the oldest is due */
+    void batchSample(Link &link, uint32_t sequence, uint16_t r, uint16_t g, uint16_t b) {
+        /* the header only numbers the first sample, the others have to follow it */
+        if (link.batch.samples() && sequence != link.batch.next()) {
+            flushStream(link);
+        }
+        uint64_t now = Kernel::get_ms_count();
+        link.batch.append(streamLayout(), sequence, now, r, g, b);
+        uint64_t age = now - link.batch.started();
+        if (link.batch.full(streamPayload(link)) || age >= _config.flush_ms ||
+            !armFlush(link.stream_flush_event, _config.flush_ms - age, &RGBApp::streamDue, link)) {
+            flushStream(link);
+        }
+    }
+
+    void flushStream(Link &link) {
+        link.counters.queued += link.batch.send(_rgbService, link.tx);
+        cancelFlush(link.stream_flush_event);
+    }
+
+    /* a partial frame waits for more samples at most until its oldest one is due, no later sample may come;
+     * false if the timer cannot be queued, the frame then has to go now */
+    bool armFlush(int &event, uint32_t wait, void (RGBApp::*due)(uint8_t), const Link &link) {
+        if (event == 0) {
+            event = _event_queue.call_in(wait, this, due, (uint8_t) (&link - _links));
+        }
+        return event != 0;
+    }
+
+    void cancelFlush(int &event) {
+        if (event) {
+            _event_queue.cancel(event);
+            event = 0;
+        }
+    }
+
+    void streamDue(uint8_t index) {
+        Link &link = _links[index];
+        link.stream_flush_event = 0;
+        if (link.connected) {
+            flushStream(link);
+            pumpReliable(link);
+        }
+    }
+
+    void historyDue(uint8_t index) {
+        Link &link = _links[index];
+        link.history_flush_event = 0;
+        if (link.connected) {
+            pumpHistory(link);
+        }
+    }
+
+    /**
+     * Without a flash log to recover numbering from, KVStore keeps a ceiling
+     * that numbers are given below: once the next one reaches it, the next
+     * MBED_CONF_APP_SEQUENCE_RESERVE are reserved with a single write, and a
+     * reset resumes at the ceiling, past any number given before it.
+     */
+    void reserveSequence(uint32_t next) {
+        if (_log.ready() || next < _sequence_reserved) {
+            return;
         }
+        _sequence_reserved = next + MBED_CONF_APP_SEQUENCE_RESERVE;
+        storage_save(STORAGE_KEY("sequence"), _sequence_reserved);
+    }
+
+    /* empty the RAM ring, the next sample gets `first`; the statistics window goes with it */
+    void restartHistory(uint32_t first, bool packed) {
+        _log.flush();
+        _log.skip(first);
+        scheduleLog();
+        _history.restart(first, packed);
+        reserveSequence(first);
+        _stats.reset();
+    }
+
+    /* program the sensor and the sampling ticker with _config, restarting the sampling period from now */
+    void applyConfig() {
+        RGBsensor.Range(_config.range);
+        RGBsensor.Resolution(_config.resolution);
+        /* 12 bit samples are kept packed, the RAM ring starts over in the new layout and the flash log
+         * serves what it held, its open block sealed first so none of it waits in RAM only */
+        bool packed = _config.resolution == ISL29125_12BIT;
+        if (_history.packed() != packed) {
+            restartHistory(_history.end(), packed);
+        }
+        /* activity speeds sampling up to the fastest the resolution allows, steady light slows it down to
+         * adaptive-steady-multiplier times the configured period */
+        uint32_t fastest = _config.minPeriod();
+        if (fastest < MBED_CONF_APP_ADAPTIVE_MIN_PERIOD_MS) fastest = MBED_CONF_APP_ADAPTIVE_MIN_PERIOD_MS;
+        uint32_t slowest = _config.period_ms;
+        if (slowest > CONFIG_MAX_PERIOD_MS / MBED_CONF_APP_ADAPTIVE_STEADY_MULTIPLIER) {
+            slowest = CONFIG_MAX_PERIOD_MS;
+        } else {
+            slowest *= MBED_CONF_APP_ADAPTIVE_STEADY_MULTIPLIER;
+        }
+        if (MBED_CONF_APP_ADAPTIVE_RATE) {
+            _rate.configure(fastest < _config.period_ms ? fastest : _config.period_ms, slowest,
+                            MBED_CONF_APP_ADAPTIVE_THRESHOLD_PERMILLE);
+        } else {
+            _rate.configure(_config.period_ms, _config.period_ms, MBED_CONF_APP_ADAPTIVE_THRESHOLD_PERMILLE);
+        }
+        _period_ms = _rate.period();
+        updateSensors.attach_us(&updateMeasurments, _period_ms * 1000);
+
+        uint8_t value[RGBService::CONFIG_SIZE];
+        _config.encode(value);
+        _rgbService.setConfig(value);
+        printf("Sampling every %lu ms, %s lux, %s bit\r\n", (unsigned long) _config.period_ms,
+               _config.range == ISL29125_10KLX ? "10000" : "375", _config.resolution == ISL29125_12BIT ? "12" : "16");
+    }
+
+    /**
+     * Calibration, the scene model and the configuration change what the
+     * node tells every client and outlive the connection, so only the
+     * gateway may write them, over its encrypted link: a central that has
+     * not encrypted gets the error that makes it do so, any other one is
+     * not authorized.
+     */
+    bool authorizeWriter(GattWriteAuthCallbackParams *params) {
+        Link *link = findLink(params->connHandle);
+        if (!link || !link->encrypted) {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INSUFFICIENT_AUTHENTICATION;
+            return false;
+        }
+        if (!link->gateway) {
+            params->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INSUFFICIENT_AUTHORIZATION;
+            return false;
+        }
+        return true;
+    }
+
+    void authorizeConfig(GattWriteAuthCallbackParams *params) {
+        if (authorizeWriter(params)) {
+            SensorConfig::authorize(params);
+        }
+    }
+
+    void authorizeCalibration(GattWriteAuthCallbackParams *params) {
+        if (authorizeWriter(params)) {
+            _calibrator.authorize(params);
+        }
+    }
+
+    void authorizeSceneModel(GattWriteAuthCallbackParams *params) {
+        if (authorizeWriter(params)) {
+            _scenes.authorize(params);
+        }
+    }
+
+    /**
+     * The flash log takes the sectors right below the bond store, itself
+     * right below the KVStore, and above the application image.
+     */
+    bool logRegion(uint32_t &floor, uint32_t &end) {
+        end = storageBase() - MBED_CONF_APP_BOND_STORE_SIZE;
+        floor = appEnd();
+        return MBED_CONF_APP_FLASH_LOG_SECTORS > 0 && storageInFlash();
+    }
+
+    /* first flash address past the application image */
+    uint32_t appEnd() {
+#ifdef FLASHIAP_APP_ROM_END_ADDR
+        return FLASHIAP_APP_ROM_END_ADDR;
+#else
+        return _flash.get_flash_start();
+#endif
+    }
+
+    /**
+     * Bottom of the KVStore: the range mbed_app.json gives TDB_INTERNAL if
+     * it sets one, else where mbed puts the store by default, the last two
+     * sectors of internal flash, so an upgrade finds its keys where the
+     * previous image left them. A target whose default KVStore is not in
+     * internal flash leaves those two sectors unused.
+     */
+    static uint32_t storageBase() {
+#if DEVICE_FLASH
+        if (MBED_CONF_STORAGE_TDB_INTERNAL_INTERNAL_BASE_ADDRESS != 0) {
+            return MBED_CONF_STORAGE_TDB_INTERNAL_INTERNAL_BASE_ADDRESS;
+        }
+        FlashIAP flash;
+        if (flash.init() != 0) {
+            return 0;
+        }
+        uint32_t end = flash.get_flash_start() + flash.get_flash_size();
+        uint32_t base = end - STORAGE_DEFAULT_SECTORS * flash.get_sector_size(end - 1);
+        flash.deinit();
+        return base;
+#else
+        return 0;
+#endif
+    }
+
+    /* true if the KVStore, and so the regions placed below it, lies inside the flash */
+    bool storageInFlash() {
+        uint32_t base = storageBase();
+        return base > _flash.get_flash_start() && base < _flash.get_flash_start() + _flash.get_flash_size();
+    }
+
+    /**
+     * Bonds live in a LittleFS right below the KVStore, so the keys, and the
+     * CCCDs the stack keeps with them, survive a reset. NULL keeps them in
+     * RAM, where the target has no room or the store cannot be mounted.
+     */
+    const char *bondDatabase() {
+#if DEVICE_FLASH
+        if (MBED_CONF_APP_BOND_STORE_SIZE == 0 || !storageInFlash() ||
+                storageBase() - MBED_CONF_APP_BOND_STORE_SIZE < appEnd()) {
+            return NULL;
+        }
+        if (_bond_fs.mount(&_bond_device) != 0 && _bond_fs.reformat(&_bond_device) != 0) {
+            printf("Bond store unavailable, bonds kept in RAM\r\n");
+            return NULL;
+        }
+        return BOND_DATABASE;
+#else
+        return NULL;
+#endif
+    }
+
+    /* program the flash log one chunk per event so BLE events get in between */
+    void scheduleLog() {
+        if (_log.pending() && _log_event == 0) {
+            _log_event = _event_queue.call(this, &RGBApp::logStep);
+        }
+    }
+
+    void logStep() {
+        _log_event = 0;
+        _log.step();
+        scheduleLog();
+    }
+
+    /* read back the CCCDs of a link, a new history subscriber starts with the backlog */
+    void refreshSubscriptions(Link &link) {
+        uint16_t previous = link.subscriptions;
+        link.subscriptions = _rgbService.subscriptions(link.handle);
+        if (!(link.subscriptions & RGBService::STREAM_SUBSCRIBED)) {
+            link.batch.clear();
+            link.reliable.enabled = false;
+        }
+        if (!(link.subscriptions & RGBService::BURST_SUBSCRIBED)) {
+            link.burst_next = BurstRecorder::IDLE;
+        }
+        if (!(link.subscriptions & RGBService::HISTORY_SUBSCRIBED)) {
+            link.download.backlog = false;
+        } else if (!(previous & RGBService::HISTORY_SUBSCRIBED)) {
+            /* the gateway resumes where it dropped, any other central gets all that is held in RAM */
+            HistoryDownload::follow(link.download, link.gateway ? _gateway.record().next : _history.begin());
+            SampleReader::reset(link.cursor);
+            pumpHistory(link);
+        }
+    }
+
+    /* commands written to the control point, little endian */
+    enum {
+        CONTROL_REQUEST_SEQUENCE = 0x01,    // then up to BULK_MAX_RANGES (first, count) pairs, 32 bit each
+        CONTROL_REQUEST_TIME = 0x02,        // then first and end log time in ms, 32 bit each
+        CONTROL_ACK = 0x03,                 // then the count of history frames received since the request, 16 bit
+        CONTROL_ABORT = 0x04,               // drop the requests, back to following new samples
+        CONTROL_REQUEST_ROLLUP = 0x05,      // then the level, 8 bit, the start in log time ms, 32 bit, and a period count, 16 bit
+        CONTROL_BURST_ARM = 0x06,           // then the channel and trigger, 8 bit, threshold, pre- and post-trigger samples, 16 bit
+        CONTROL_BURST_FETCH = 0x07,         // send the last capture again
+        CONTROL_BURST_DISARM = 0x08,        // stop waiting for the trigger, back to live samples
+        CONTROL_FLICKER_MEASURE = 0x09,     // then the channel, 8 bit
+        CONTROL_COUNTERS = 0x0A,            // read the acquisition and delivery counters of this central
+        CONTROL_GATEWAY = 0x0B              // then 1 to claim the gateway role for this bonded central, 0 to give it up
+    };
+
+    void onDataWritten(const GattWriteCallbackParams *params) {
+        Link *link = findLink(params->connHandle);
+        if (!link) {
+            return;
+        }
+        if (params->handle == _rgbService.queryHandle()) {
+            onQuery(*link, params->data, params->len);
+            return;
+        }
+        if (params->handle == _rgbService.streamAckHandle()) {
+            onStreamAck(*link, params->data, params->len);
+            return;
+        }
+        if (params->handle == _rgbService.sceneModelHandle()) {
+            _scenes.written(params->data, params->len);
+            return;
+        }
+        if (params->handle == _rgbService.calibrationHandle()) {
+            _calibrator.written(params->data);
+            return;
+        }
+        if (params->handle == _rgbService.configHandle()) {
+            /* already checked by authorizeConfig, takes effect after the next sample */
+            _next_config.decode(params->data);
+            _config_pending = true;
+            return;
+        }
+        if (params->handle != _rgbService.controlHandle() || params->len < 1) {
+            return;
+        }
+
+        const uint8_t *p = &params->data[1];
+        uint16_t len = params->len - 1;
+        switch (params->data[0]) {
+            case CONTROL_REQUEST_SEQUENCE:
+                if (!_downloads.requestSequences(link->download, p, len)) {
+                    return;
+                }
+                break;
+            case CONTROL_REQUEST_TIME:
+                if (len != 8) {
+                    return;
+                }
+                _downloads.requestRange(link->download, _reader.sequenceAt(get32(&p[0])), _reader.sequenceAt(get32(&p[4])));
+                break;
+            case CONTROL_ACK:
+                if (len != 2) {
+                    return;
+                }
+                HistoryDownload::ack(link->download, p[0] | (p[1] << 8));
+                break;
+            case CONTROL_ABORT:
+                HistoryDownload::abort(link->download);
+                break;
+            case CONTROL_REQUEST_ROLLUP:
+                if (len != 7 ||
+                    !RollupPublisher::request(link->rollup, p[0], _reader.unwrapTime(get32(&p[1])), p[5] | (p[6] << 8))) {
+                    return;
+                }
+                break;
+            case CONTROL_BURST_ARM:
+                if (len != 8) {
+                    return;
+                }
+                armBurst(p);
+                break;
+            case CONTROL_BURST_FETCH:
+                if (_burst.done()) {
+                    link->burst_next = BurstRecorder::INFO;
+                }
+                break;
+            case CONTROL_BURST_DISARM:
+                if (_burst.capturing()) {
+                    _burst.disarm();
+                    stopFastSampling();
+                }
+                break;
+            case CONTROL_FLICKER_MEASURE:
+                if (len != 1) {
+                    return;
+                }
+                measureFlicker(p[0]);
+                break;
+            case CONTROL_COUNTERS:
+                publishCounters(*link);
+                break;
+            case CONTROL_GATEWAY:
+                if (len != 1 || p[0] > 1) {
+                    return;
+                }
+                if (p[0]) {
+                    claimGateway(*link);
+                } else {
+                    releaseGateway(*link);
+                }
+                break;
+            default:
+                return;
+        }
+        pump(*link);
+    }
+
+    /* single channel at 12 bit, the sensor's fastest rate, polled from a ticker; regular sampling waits */
+    void startFastSampling(uint8_t channel) {
+        RGBsensor.Resolution(ISL29125_12BIT);
+        RGBsensor.RGBmode(channel);
+        _fast_channel = channel;
+        _fast_timer.reset();
+        _fast_timer.start();
+        _fast_ticker.attach_us(callback(this, &RGBApp::onFastTick), FAST_POLL_US);
+    }
+
+    /* back to the acquisition settings of regular sampling */
+    void stopFastSampling() {
+        _fast_ticker.detach();
+        _fast_timer.stop();
+        _fast_channel = 0;
+        RGBsensor.RGBmode(ISL29125_RGB);
+        RGBsensor.Resolution(_config.resolution);
+    }
+
+    /* ticker interrupt: the I2C read is done from the event queue, never more than one waits in it */
+    void onFastTick() {
+        if (!_fast_pending) {
+            _fast_pending = _event_queue.call(this, &RGBApp::fastSample) != 0;
+        }
+    }
+
+    void fastSample() {
+        _fast_pending = false;
+        uint16_t value;
+        if (!_fast_channel || !RGBsensor.Read(_fast_channel, &value)) {
+            return;
+        }
+        uint32_t now_us = _fast_timer.read_us();
+        if (_burst.capturing()) {
+            burstSample(value, now_us);
+        } else if (_flicker.busy() && _flicker.add(value, now_us, _log.time(Kernel::get_ms_count()))) {
+            stopFastSampling();
+        }
+    }
+
+    /* capture at the fastest rate until the trigger and the post-trigger samples have come */
+    void armBurst(const uint8_t *p) {
+        BurstCapture::settings_t settings;
+        if (_flicker.busy() || !BurstRecorder::decode(p, settings)) {
+            return;
+        }
+        if (_burst.capturing()) {
+            _burst.disarm();
+            stopFastSampling();
+        }
+        if (!_burst.arm(settings, _config.range)) {
+            return;
+        }
+        /* the ring is overwritten, an upload of the previous capture stops here */
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            _links[i].burst_next = BurstRecorder::IDLE;
+        }
+        startFastSampling(_burst.sensorChannel());
+    }
+
+    void burstSample(uint16_t value, uint32_t now_us) {
+        if (!_burst.add(value, now_us, _log.time(Kernel::get_ms_count()))) {
+            return;
+        }
+        stopFastSampling();
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            Link &link = _links[i];
+            if (!link.connected || !(link.subscriptions & RGBService::BURST_SUBSCRIBED)) continue;
+            link.burst_next = BurstRecorder::INFO;
+            pump(link);
+        }
+    }
+
+    /* take FlickerAnalyzer::SAMPLES conversions in a row at the fastest rate for the meter to analyse */
+    void measureFlicker(uint8_t channel) {
+        if (!_burst.capturing() && _flicker.start(channel)) {
+            startFastSampling(_flicker.sensorChannel());
+        }
+    }
+
+    /* called back by the meter once its analysis is done */
+    void flickerResult() {
+        notifySubscribers(RGBService::FLICKER_SUBSCRIBED, _flicker);
+    }
+
+    /**
+     * Min, max and mean between two log times, the flash log part read
+     * QUERY_STEP_SAMPLES per event so BLE events get in between. A new query
+     * from the central replaces one still being read.
+     */
+    void onQuery(Link &link, const uint8_t *data, uint16_t len) {
+        if (len != RGBService::QUERY_REQUEST_SIZE) {
+            return;
+        }
+        if (_queries.start(link.query, _reader.sequenceAt(get32(&data[0])), _reader.sequenceAt(get32(&data[4])))) {
+            scheduleQuery();
+        } else {
+            publishQuery(link);
+        }
+    }
+
+    /* the next samples of every query reading the flash log */
+    void queryStep() {
+        _query_event = 0;
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            Link &link = _links[i];
+            if (link.connected && link.query.busy) {
+                scanQuery(link, QUERY_STEP_SAMPLES);
+            }
+        }
+        scheduleQuery();
+    }
+
+    /* a full event queue reads what is left at once rather than leave a query unanswered */
+    void scheduleQuery() {
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS && _query_event == 0; i++) {
+            Link &link = _links[i];
+            if (!link.connected || !link.query.busy) continue;
+            _query_event = _event_queue.call(this, &RGBApp::queryStep);
+            if (_query_event == 0) {
+                scanQuery(link, 0xFFFFFFFF);
+            }
+        }
+    }
+
+    /* add up to `samples` samples of the flash log to a query, the result goes out once they run past its end */
+    void scanQuery(Link &link, uint32_t samples) {
+        if (_queries.scan(link.query, samples)) {
+            publishQuery(link);
+        }
+    }
+
+    void publishQuery(Link &link) {
+        _queries.publish(link.query, link.tx, notifyPayload(link), link.subscriptions & RGBService::QUERY_SUBSCRIBED);
+    }
+
+    /* where the samples went: not taken by the sensor, held back by the firmware or lost on the link */
+    void publishCounters(Link &link) {
+        _counters.publish(link.counters, _history.end() - 1, link.tx, notifyPayload(link),
+                          link.subscriptions & RGBService::COUNTERS_SUBSCRIBED);
+    }
+
+    /* what is waiting for a link, the short rollup replies first */
+    void pump(Link &link) {
+        pumpRollup(link);
+        pumpBurst(link);
+        pumpHistory(link);
+        pumpReliable(link);
+    }
+
+    /* reliable stream frames, a partial one of new samples held until its oldest sample is due */
+    void pumpReliable(Link &link) {
+        if (!link.reliable.enabled || !(link.subscriptions & RGBService::STREAM_SUBSCRIBED)) {
+            return;
+        }
+
+        uint16_t per_frame = streamFrameSamples(streamPayload(link));
+        uint32_t queued = link.counters.queued;
+        uint32_t wait = _reliable.pump(link.reliable, link.batch, link.cursor, link.tx, per_frame, streamLayout(),
+                                       _config.flush_ms, link.counters.queued);
+        if (link.counters.queued != queued) {
+            cancelFlush(link.stream_flush_event);
+        }
+        /* without a timer the partial frame goes now */
+        if (wait && !armFlush(link.stream_flush_event, wait, &RGBApp::streamDue, link)) {
+            _reliable.pump(link.reliable, link.batch, link.cursor, link.tx, per_frame, streamLayout(),
+                           0, link.counters.queued);
+        }
+
+        if (ReliableStream::waiting(link.reliable) && _reliable_event == 0) {
+            _reliable_event = _event_queue.call_in(MBED_CONF_APP_RELIABLE_TIMEOUT_MS, this, &RGBApp::checkReliable);
+        }
+    }
+
+    /* the first ACK turns the link's stream reliable from the sample it names, later ones move the window */
+    void onStreamAck(Link &link, const uint8_t *data, uint16_t len) {
+        if (len != RGBService::STREAM_ACK_SIZE || !(link.subscriptions & RGBService::STREAM_SUBSCRIBED)) {
+            return;
+        }
+        uint32_t ack = get32(data);
+        if (!link.reliable.enabled) {
+            flushStream(link);
+            /* the gateway holds samples numbered before a reset that lost them from flash too: numbering
+             * jumps past them, so it sees a gap rather than new samples under numbers it already has. Only
+             * as far as the numbers a reset can lose, anything further is not trusted to renumber by */
+            uint32_t ahead = ack - _history.end();
+            if ((int32_t) ahead > 0) {
+                if (link.gateway && link.encrypted && ahead <= lostNumbers()) {
+                    printf("Gateway acknowledged %lu, numbering resumes there\r\n", (unsigned long) ack);
+                    restartHistory(ack, _history.packed());
+                } else {
+                    printf("Stream ACK %lu is %lu samples past the last one, ignored\r\n",
+                           (unsigned long) ack, (unsigned long) ahead);
+                }
+            }
+        }
+        _reliable.ack(link.reliable, ack);
+        pumpReliable(link);
+    }
+
+    /* most numbers given before a reset that the node may not know of after it: what the flash log may have
+     * held in RAM only, or without one, what is left of a KVStore reservation */
+    uint32_t lostNumbers() const {
+        return _log.ready() ? SampleLog::recoveryGap() : MBED_CONF_APP_SEQUENCE_RESERVE;
+    }
+
+    /* links whose ACK has not moved for MBED_CONF_APP_RELIABLE_TIMEOUT_MS go back to it */
+    void checkReliable() {
+        _reliable_event = 0;
+        uint64_t now = Kernel::get_ms_count();
+        uint32_t wait = 0;  // until the next link is due, 0 while none waits for an ACK
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            Link &link = _links[i];
+            if (!link.connected || !ReliableStream::waiting(link.reliable)) continue;
+            if (ReliableStream::left(link.reliable, now) == 0) {
+                link.counters.retransmitted += ReliableStream::rewind(link.reliable);
+                pumpReliable(link);
+                if (!ReliableStream::waiting(link.reliable)) continue;
+            }
+            uint32_t left = ReliableStream::left(link.reliable, now);
+            if (wait == 0 || left < wait) wait = left;
+        }
+        /* going back may have armed the check already, the nearest deadline wins */
+        if (wait) {
+            if (_reliable_event) _event_queue.cancel(_reliable_event);
+            _reliable_event = _event_queue.call_in(wait, this, &RGBApp::checkReliable);
+        }
+    }
+
+    /* send the info frame of the last capture, then its samples and an empty frame */
+    void pumpBurst(Link &link) {
+        if (link.subscriptions & RGBService::BURST_SUBSCRIBED) {
+            _burst.pump(link.burst_next, link.tx, streamPayload(link));
+        }
+    }
+
+    /* send the requested rollups, consecutive periods packed in a frame, then an empty frame */
+    void pumpRollup(Link &link) {
+        if (link.rollup.pending && (link.subscriptions & RGBService::ROLLUP_SUBSCRIBED)) {
+            _rollups.pump(link.rollup, link.tx, streamPayload(link));
+        }
+    }
+
+    /* history frames, a partial one of new samples held until its oldest sample is due */
+    void pumpHistory(Link &link) {
+        if (!(link.subscriptions & RGBService::HISTORY_SUBSCRIBED)) {
+            return;
+        }
+
+        uint16_t sent = link.download.frames_sent;
+        uint32_t wait = _downloads.pump(link.download, link.cursor, link.tx, streamPayload(link), _config.flush_ms);
+        if (link.download.frames_sent != sent) {
+            cancelFlush(link.history_flush_event);
+        }
+        /* without a timer the partial frame goes now */
+        if (wait && !armFlush(link.history_flush_event, wait, &RGBApp::historyDue, link)) {
+            _downloads.pump(link.download, link.cursor, link.tx, streamPayload(link), 0);
+        }
+    }
+
+    /* send the latest value of a feature to every central subscribed to it */
+    template<typename Publisher>
+    void notifySubscribers(uint16_t subscription, Publisher &publisher) {
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            Link &link = _links[i];
+            if (link.connected && (link.subscriptions & subscription)) {
+                publisher.notify(link.tx, notifyPayload(link));
+            }
+        }
+    }
+
+    /* connected slot for a handle, or the first free slot */
+    Link *findLink(ble::connection_handle_t connectionHandle, bool free = false) {
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            Link &link = _links[i];
+            if (free ? !link.connected : (link.connected && link.handle == connectionHandle)) {
+                return &link;
+            }
+        }
+        return NULL;
+    }
+
+    uint8_t connectedCount() const {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < MBED_CONF_APP_MAX_CONNECTIONS; i++) {
+            if (_links[i].connected) count++;
+        }
+        return count;
     }
 
 private:
     BLE &_ble;
     events::EventQueue &_event_queue;
-    bool _connected;
     RGBService _rgbService;
+    Link _links[MBED_CONF_APP_MAX_CONNECTIONS];
+    TxCredits _tx_credits;      // controller TX buffers, shared by the links
+    uint8_t _tx_turn;           // link first served when buffers are released
+    int _tx_retry_event;        // tries the controller again after BLE_ERROR_NO_MEM
+
+    int _slow_adv_event;
+    uint64_t _adv_fast_since;
+    bool _directed;
+    GatewayStore _gateway;
+#if DEVICE_FLASH
+    FlashIAPBlockDevice _bond_device;
+    LittleFileSystem _bond_fs;
+#endif
+    SampleHistory _history;
+    LogFlash _flash;
+    SampleLog _log;
+    SampleReader _reader;
+    HistoryDownload _downloads;
+    ReliableStream _reliable;
+    int _log_event;
+    uint32_t _sequence_reserved;    // without a flash log, numbers below this one are reserved in KVStore
+    RollupPublisher _rollups;
+    Ticker _fast_ticker;
+    Timer _fast_timer;
+    uint8_t _fast_channel;      // channel polled at the fastest rate, 0 during regular sampling
+    volatile bool _fast_pending;    // a fastSample() waits in the event queue
+    BurstRecorder _burst;
+    FlickerMeter _flicker;
+    StatsPublisher _stats;
+    EventPublisher _events;
+    ScenePublisher _scenes;
+    Calibrator _calibrator;
+    SensorConfig _config;
+    SensorConfig _next_config;  // written by a client, applied after the next sample
+    bool _config_pending;
+    AdaptiveRate _rate;
+    uint32_t _period_ms;        // sampling period in use, between the adaptive bounds
+    CounterPublisher _counters;
+    int _reliable_event;        // pending retransmission check
+    QueryPublisher _queries;
+    int _query_event;           // pending step of the queries reading the flash log
+    struct {
+        uint32_t count;
+        uint32_t slow;      // connections made after the back-off to the slow interval
+        uint32_t last_ms;
+        uint32_t min_ms;
+        uint32_t max_ms;
+        uint64_t total_ms;
+    } _reconnect;
+#if MBED_CONF_APP_BROADCAST_MODE
+    BroadcastSample _broadcast;
+#endif
 };
 
 void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *context) {
     event_queue.call(Callback<void()>(&context->ble, &BLE::processEvents));
 }
 
-void start_advertising(BLE &ble) {
-    ble::AdvertisingDataBuilder builder(adv_buffer);
+/* prefer LE 2M for every new connection when the controller supports it */
+void set_preferred_phys(BLE &ble) {
+    if (!ble.gap().isFeatureSupported(ble::controller_supported_features_t::LE_2M_PHY)) {
+        printf("LE 2M PHY not supported, using LE 1M\r\n");
+        return;
+    }
 
-    builder.setFlags();
-    builder.setName(DEVICE_NAME);
-    builder.setLocalServiceList(mbed::make_Span(uuid_list, sizeof(uuid_list) / sizeof(UUID)));
+    ble::phy_set_t phys(/* 1M */ false, /* 2M */ true, /* coded */ false);
+    ble_error_t error = ble.gap().setPreferredPhys(&phys, &phys);
+    if (error) {
+        print_error(error, "Gap::setPreferredPhys failed");
+    }
+}
 
+/* (re)start advertising with the given interval */
+void start_advertising(BLE &ble, uint32_t interval_ms) {
+    if (ble.gap().isAdvertisingActive(ble::LEGACY_ADVERTISING_HANDLE)) {
+        ble.gap().stopAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+    }
+
+#if MBED_CONF_APP_BROADCAST_MODE
+    /* no connections: samples are carried by the advertising payload itself */
+    ble::AdvertisingParameters adv_parameters(
+        ble::advertising_type_t::NON_CONNECTABLE_UNDIRECTED,
+        ble::adv_interval_t(ble::millisecond_t(interval_ms))
+    );
+#else
     ble::AdvertisingParameters adv_parameters(
         ble::advertising_type_t::CONNECTABLE_UNDIRECTED,
-        ble::adv_interval_t(ble::millisecond_t(1000))
+        ble::adv_interval_t(ble::millisecond_t(interval_ms))
     );
+#endif
 
     ble_error_t error = ble.gap().setAdvertisingParameters(ble::LEGACY_ADVERTISING_HANDLE, adv_parameters);
     if (error) {
@@ -158,12 +1523,33 @@ void start_advertising(BLE &ble) {
         return;
     }
 
-    error = ble.gap().setAdvertisingPayload(ble::LEGACY_ADVERTISING_HANDLE, builder.getAdvertisingData());
+#if MBED_CONF_APP_BROADCAST_MODE
+    error = ble.gap().setAdvertisingPayload(
+        ble::LEGACY_ADVERTISING_HANDLE,
+        mbed::make_const_Span((const uint8_t *) &broadcast_payload, sizeof(broadcast_payload))
+    );
+#else
+    error = ble.gap().setAdvertisingPayload(
+        ble::LEGACY_ADVERTISING_HANDLE,
+        mbed::make_const_Span((const uint8_t *) &adv_payload, sizeof(adv_payload))
+    );
+#endif
     if (error) {
         printf("Error during Gap::setAdvertisingPayload: %d\n", error);
         return;
     }
 
+#if !MBED_CONF_APP_BROADCAST_MODE
+    error = ble.gap().setAdvertisingScanResponse(
+        ble::LEGACY_ADVERTISING_HANDLE,
+        mbed::make_const_Span((const uint8_t *) &scan_response_payload, sizeof(scan_response_payload))
+    );
+    if (error) {
+        printf("Error during Gap::setAdvertisingScanResponse: %d\n", error);
+        return;
+    }
+#endif
+
     error = ble.gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
     if (error) {
         printf("Error during Gap::startAdvertising: %d\n", error);
@@ -171,6 +1557,28 @@ void start_advertising(BLE &ble) {
     }
 }
 
+/* high duty cycle directed advertising to a known central, the controller stops it after 1.28 s */
+ble_error_t start_directed_advertising(BLE &ble, const ble::address_t &peer, ble::target_peer_address_type_t peer_type) {
+    if (ble.gap().isAdvertisingActive(ble::LEGACY_ADVERTISING_HANDLE)) {
+        ble.gap().stopAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+    }
+
+    ble::AdvertisingParameters adv_parameters(ble::advertising_type_t::CONNECTABLE_DIRECTED);
+    adv_parameters.setPeer(peer, peer_type);
+
+    ble_error_t error = ble.gap().setAdvertisingParameters(ble::LEGACY_ADVERTISING_HANDLE, adv_parameters);
+    if (error) {
+        printf("Error during Gap::setAdvertisingParameters: %d\n", error);
+        return error;
+    }
+
+    error = ble.gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+    if (error) {
+        printf("Error during Gap::startAdvertising: %d\n", error);
+    }
+    return error;
+}
+
 int main() {
     BLE& mydevice = BLE::Instance();
     mydevice.onEventsToProcess(schedule_ble_events);
@@ -178,20 +1586,22 @@ int main() {
     RGBApp *eventHandler = new RGBApp(mydevice, event_queue);
     Gap& myGap = mydevice.gap();
     myGap.setEventHandler((ble::Gap::EventHandler *) eventHandler);
+    mydevice.gattServer().setEventHandler((GattServer::EventHandler *) eventHandler);
 
     mydevice.init(&on_init_complete);
 
     while (1) {
         if (sensorFlag) {
-            eventHandler->updateRGB();
+            /* cleared first, so a tick that comes while the sample is handled is not lost */
             sensorFlag = false;
+            eventHandler->updateRGB();
         }
 
         if (initFlag) {
             print_mac_address();
-            start_advertising(mydevice);
+            set_preferred_phys(mydevice);
+            eventHandler->start();
 
-            updateSensors.attach(&updateMeasurments, 1);
             initFlag = false;
         }
 
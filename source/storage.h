@@ -0,0 +1,35 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <mbed.h>
+#include "kvstore_global_api.h"
+
+/* full name of a key in the default KVStore */
+#define STORAGE_KEY(name) "/kv/" name
+
+/* read a fixed size record, false when it was never written or has another size */
+template<typename T>
+bool storage_load(const char *key, T &record) {
+    size_t actual = 0;
+    int err = kv_get(key, &record, sizeof(T), &actual);
+    return err == MBED_SUCCESS && actual == sizeof(T);
+}
+
+template<typename T>
+bool storage_save(const char *key, const T &record) {
+    int err = kv_set(key, &record, sizeof(T), 0);
+    if (err != MBED_SUCCESS) {
+        printf("Storage: cannot write %s (%d)\r\n", key, err);
+        return false;
+    }
+    return true;
+}
+
+inline void storage_remove(const char *key) {
+    int err = kv_remove(key);
+    if (err != MBED_SUCCESS && err != MBED_ERROR_ITEM_NOT_FOUND) {
+        printf("Storage: cannot remove %s (%d)\r\n", key, err);
+    }
+}
+
+#endif